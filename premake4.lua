@@ -80,7 +80,7 @@ solution "Dagon"
     targetname "dagon"
     -- GLEW_STATIC only applies to Windows, but there's no harm done if defined
     -- on other systems.
-    defines { "GLEW_STATIC", "OV_EXCLUDE_STATIC_CALLBACKS", "KTX_OPENGL" }
+    defines { "GLEW_STATIC", "OV_EXCLUDE_STATIC_CALLBACKS" }
     location "build"
     objdir "build/objs"
     buildoptions { "-Wall" }
@@ -152,7 +152,7 @@ solution "Dagon"
       libdirs { "/usr/lib", "/usr/local/lib", 
                 "extlibs/libs-osx/Frameworks", "extlibs/libs-osx/lib" }
       links { "freetype", "GLEW", "lua", "ogg", "SDL2", 
-              "vorbis", "vorbisfile", "theoradec", "ktx" }
+              "vorbis", "vorbisfile", "theoradec" }
       links { "AudioToolbox.framework", "AudioUnit.framework",
               "Carbon.framework", "Cocoa.framework", "CoreAudio.framework",
               "CoreFoundation.framework", "ForceFeedback.framework", 
@@ -168,9 +168,30 @@ solution "Dagon"
               "libtheora_static", "libvorbis_static", 
               "libvorbisfile_static", "lua", "OpenAL32",
               "SDL2", "SDL2main", "opengl32", "glu32",
-              "Imm32", "version", "winmm", "libktx" }
+              "Imm32", "version", "winmm" }
       if os.is64bit then
         libdirs { "extlibs/libs-msvc/x64" }
       else
         libdirs { "extlibs/libs-msvc/x86" }
       end
+
+  -- Offline packer converting node faces to S3TC compressed TEX bundles.
+  -- Usage: dagon-texpack [-z] [-v] [-j threads] [-s size] name [output]
+  project "dagon-texpack"
+    targetname "dagon-texpack"
+    location "build"
+    objdir "build/objs/texpack"
+    kind "ConsoleApp"
+    language "C++"
+    files { "tools/texpack/**.h", "tools/texpack/**.cpp",
+            "src/stb_image.h", "src/stb_image.c",
+            "src/TextureBundle.h", "src/TextureBundle.cpp",
+            "src/TextureCompressor.h", "src/TextureCompressor.cpp" }
+    includedirs { "src" }
+
+    configuration { "linux or bsd or macosx" }
+      buildoptions { "-Wall", "-std=c++11" }
+
+    configuration { "linux or bsd" }
+      links { "m" }
+      linkoptions { "-pthread" }
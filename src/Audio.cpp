@@ -70,14 +70,7 @@ bool Audio::isLoopable() {
 }
 
 bool Audio::isPlaying() {
-  bool value = false;
-  if (SDL_LockMutex(_mutex) == 0) {
-    value = (_state == kAudioPlaying);
-    SDL_UnlockMutex(_mutex);
-  } else {
-    log.error(kModAudio, "%s", kString18002);
-  }
-  return value;
+  return (_state == kAudioPlaying);
 }
   
 bool Audio::isVarying() {
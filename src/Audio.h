@@ -18,6 +18,7 @@
 // Headers
 ////////////////////////////////////////////////////////////
 
+#include <atomic>
 #include <string>
 
 #include "Config.h"
@@ -122,7 +123,7 @@ private:
   bool _isLoopable;
   bool _isMatched;
   bool _isVarying;
-  int _state;
+  std::atomic<int> _state; // Written with the mutex locked, read without it
   
   ALuint _alBuffers[kMaxAudioBuffers];
   ALenum _alFormat;
@@ -21,6 +21,7 @@
 #include "Config.h"
 #include "FontManager.h"
 #include "Texture.h"
+#include "TextureManager.h"
 
 namespace dagon {
 
@@ -51,7 +52,7 @@ Button::~Button() {
     delete _action;
   
   if (_hasOnHoverTexture)
-    delete _onHoverTexture;
+    TextureManager::instance().releaseImage(_onHoverTexture);
 }
 
 ////////////////////////////////////////////////////////////
@@ -88,6 +89,7 @@ Font* Button::font() {
 }
 
 Texture* Button::onHoverTexture() {
+  _onHoverTexture->load();
   return _onHoverTexture;
 }
 
@@ -116,13 +118,12 @@ void Button::setFont(const std::string &fromFileName,
 }
 
 void Button::setOnHoverTexture(const std::string &fromFileName) {
-  // TODO: Important! We should determine first if the texture already exists,
-  // to avoid repeating resources. Eventually, this would be done via the
-  // resource manager.
-  _onHoverTexture = new Texture;
-  _onHoverTexture->setResource(config.path(kPathResources, fromFileName,
-                                           kObjectImage).c_str());
-  _onHoverTexture->load();
+  TextureManager& textureManager = TextureManager::instance();
+  if (_hasOnHoverTexture)
+    textureManager.releaseImage(_onHoverTexture);
+  _onHoverTexture = textureManager.acquireImage(config.path(kPathResources,
+                                                            fromFileName,
+                                                            kObjectImage));
   _hasOnHoverTexture = true;
 }
 
@@ -53,6 +53,10 @@ Config::Config() {
   silentFeeds = kDefSilentFeeds;
   subtitles = kDefSubtitles;
   texCompression = kDefTexCompression;
+  texMemoryBudget = kDefTexMemoryBudget;
+  texTiling = kDefTexTiling;
+  texTopLevel = kDefTexTopLevel;
+  texUploadBudget = kDefTexUploadBudget;
   verticalSync = kDefVerticalSync;
   _scriptName = kDefScriptFile;
   _resPath = kDefResourcePath;
@@ -62,6 +62,10 @@ enum DefaultConfiguration {
   kDefSilentFeeds = false,
   kDefSubtitles = true,
   kDefTexCompression = false,
+  kDefTexMemoryBudget = 256, // Megabytes
+  kDefTexTiling = true, // Full resolution only around the view
+  kDefTexTopLevel = 0, // Mipmaps of node textures left out, 1 halves them
+  kDefTexUploadBudget = 4, // Milliseconds per frame
   kDefVerticalSync = true
 };
 
@@ -107,6 +111,10 @@ class Config {
   bool silentFeeds;
   bool subtitles;
   bool texCompression;
+  int texMemoryBudget;
+  bool texTiling;
+  int texTopLevel;
+  int texUploadBudget;
   bool verticalSync;
   
   double framesPerSecond();
@@ -162,6 +162,26 @@ static int ConfigLibGet(lua_State *L) {
     return 1;
   }
   
+  if (strcmp(key, "texMemoryBudget") == 0) {
+    lua_pushnumber(L, Config::instance().texMemoryBudget);
+    return 1;
+  }
+  
+  if (strcmp(key, "texTiling") == 0) {
+    lua_pushboolean(L, Config::instance().texTiling);
+    return 1;
+  }
+  
+  if (strcmp(key, "texTopLevel") == 0) {
+    lua_pushnumber(L, Config::instance().texTopLevel);
+    return 1;
+  }
+  
+  if (strcmp(key, "texUploadBudget") == 0) {
+    lua_pushnumber(L, Config::instance().texUploadBudget);
+    return 1;
+  }
+  
   if (strcmp(key, "texExtension") == 0) {
     lua_pushstring(L, Config::instance().texExtension().c_str());
     return 1;
@@ -262,6 +282,18 @@ static int ConfigLibSet(lua_State *L) {
   if (strcmp(key, "texCompression") == 0)
     Config::instance().texCompression = (bool)lua_toboolean(L, 3);
   
+  if (strcmp(key, "texMemoryBudget") == 0)
+    Config::instance().texMemoryBudget = (int)luaL_checknumber(L, 3);
+  
+  if (strcmp(key, "texTiling") == 0)
+    Config::instance().texTiling = (bool)lua_toboolean(L, 3);
+  
+  if (strcmp(key, "texTopLevel") == 0)
+    Config::instance().texTopLevel = (int)luaL_checknumber(L, 3);
+  
+  if (strcmp(key, "texUploadBudget") == 0)
+    Config::instance().texUploadBudget = (int)luaL_checknumber(L, 3);
+  
   if (strcmp(key, "texExtension") == 0)
     Config::instance().setTexExtension(luaL_checkstring(L, 3));
   
@@ -146,8 +146,8 @@ void Control::init(int argc, char* argv[]) {
   // Init the font library
   fontManager.init();
 
-  // Init the texture manager
-  //textureManager.init(); // Preloader thread not working yet
+  // Init the texture manager, which spawns the decoding threads
+  textureManager.init();
 
   // Init the video manager
   videoManager.init();
@@ -548,6 +548,10 @@ void Control::reshape(int width, int height) {
   feedManager.reshape();
   renderManager.reshape();
 
+  int drawableWidth, drawableHeight;
+  system.drawableSize(drawableWidth, drawableHeight);
+  textureManager.selectTier(drawableWidth, drawableHeight);
+
   if (_eventHandlers.hasResize)
     script.processCallback(_eventHandlers.resize, 0);
 }
@@ -864,7 +868,7 @@ void Control::switchTo(Object* theTarget) {
       // Now we proceed to load the textures of the current node
       Node* current = _currentRoom->currentNode();
       //log.trace(kModControl, "Flushing textures...");
-      textureManager.flush();
+      textureManager.flush(current);
 
       if (current->hasSpots()) {
         current->beginIteratingSpots();
@@ -899,8 +903,7 @@ void Control::switchTo(Object* theTarget) {
 
               video->play();
 
-              DGFrame* frame = video->currentFrame();
-              spot->texture()->loadRawData(frame->data, frame->width, frame->height);
+              spot->texture()->loadVideoFrame(video);
 
               video->pause();
             }
@@ -908,11 +911,16 @@ void Control::switchTo(Object* theTarget) {
 
           if (spot->hasTexture()) {
             //log.trace(kModControl, "Loading image...");
-            textureManager.requestTexture(spot->texture());
-
-            // Only resize if nothing but origin
-            if (spot->vertexCount() == 1)
+            // Only resize if nothing but origin, in which case we need the
+            // size of the texture right away. Everything else is decoded in
+            // the background and drawn as soon as it's uploaded.
+            if (spot->vertexCount() == 1) {
+              textureManager.requestTexture(spot->texture());
               spot->resize(spot->texture()->width(), spot->texture()->height());
+            }
+            else {
+              textureManager.queueTexture(spot->texture());
+            }
           }
 
           if (spot->hasFlag(kSpotAuto) || spot->isPlaying())
@@ -923,6 +931,10 @@ void Control::switchTo(Object* theTarget) {
         log.warning(kModControl, "%s", kString12006);
       }
 
+      // Decode the nodes we can reach from here while the player looks
+      // around, cancelling anything pending for the previous node
+      textureManager.prefetchLinks(current);
+
       // Prepare the name for the window
       char title[kMaxObjectName];
       snprintf(title, kMaxObjectName, "%s (%s, %s)", config.script().c_str(),
@@ -1009,6 +1021,7 @@ void Control::terminate() {
   _isRunning = false;
 
   audioManager.terminate();
+  textureManager.terminate();
   timerManager.terminate();
   videoManager.terminate();
 
@@ -1028,6 +1041,9 @@ void Control::terminate() {
 }
 
 void Control::update() {
+  // Upload the textures decoded in the background since the last frame
+  textureManager.update();
+
   switch (_state->current()) {
     case StateLookAt:
       cameraManager.panToTargetAngle();
@@ -45,14 +45,7 @@ config(Config::instance())
 ////////////////////////////////////////////////////////////
 
 CursorManager::~CursorManager() {
-  if (!_arrayOfCursors.empty()) {
-    _current = _arrayOfCursors.begin();
-    
-    while (_current != _arrayOfCursors.end()) {
-      delete (*_current).image;
-      ++_current;
-    }
-  }
+  // Cursor images belong to the texture manager, which deletes them on exit
 }
 
 ////////////////////////////////////////////////////////////
@@ -71,6 +64,10 @@ float* CursorManager::arrayOfCoords() {
   return _arrayOfCoords;
 }
 
+float* CursorManager::arrayOfTexCoords() {
+  return (*_current).image->texCoords();
+}
+
 bool CursorManager::hasAction() {
   return _hasAction;
 }
@@ -83,12 +80,13 @@ bool CursorManager::isDragging() {
   return _isDragging;
 }
 
-// NOTE: These textures aren't managed
+// NOTE: These textures are shared with images but never released
 void CursorManager::load(int typeOfCursor, const char* imageFromFile, int offsetX, int offsetY) {
   Texture* texture;
   
-  texture = new Texture;
-  texture->setResource(config.path(kPathResources, imageFromFile, kObjectCursor).c_str());
+  texture = TextureManager::instance().acquireImage(config.path(kPathResources,
+                                                                imageFromFile,
+                                                                kObjectCursor));
   texture->load();
   
   _arrayOfCursors.push_back(_makeCursorData(typeOfCursor, texture,
@@ -78,6 +78,7 @@ public:
   Action* action();
   void bindImage();
   float* arrayOfCoords();
+  float* arrayOfTexCoords(); // Of the current image
   bool hasAction();
   bool hasImage();
   bool isDragging();
@@ -29,8 +29,10 @@
 #define kDefVideoPath "video/"
 #define kDefResourcePath "resources/"
 #define kDefSavePath "saves/"
+#define kDefTexCachePath "cache/"
 #define kDefConfigFile "config.lua"
 #define kDefLogFile "dagon.log"
+#define kDefImageSizesFile "images.cache"
 #define kDefTexExtension "tex"
 #define kDefSaveExtension "sav"
 
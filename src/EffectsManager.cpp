@@ -18,6 +18,8 @@
 #include "CameraManager.h"
 #include "Config.h"
 #include "EffectsManager.h"
+#include "Language.h"
+#include "Log.h"
 #include "Texture.h"
 #include "TimerManager.h"
 
@@ -58,6 +60,8 @@ timerManager(TimerManager::instance())
   
   _calculateDustData();
   
+  _videoFragment = 0;
+  _videoProgram = 0;
   _isActive = false;
   _isInitialized = false;
 }
@@ -74,6 +78,12 @@ EffectsManager::~EffectsManager() {
     glDeleteShader(_fragment);
     glDeleteProgram(_program);
     
+    if (_videoProgram) {
+      glDetachShader(_videoProgram, _videoFragment);
+      glDeleteProgram(_videoProgram);
+    }
+    glDeleteShader(_videoFragment);
+    
     delete _dustTexture;
     
     _isActive = false;
@@ -200,6 +210,20 @@ void EffectsManager::_updateShader(int theEffect, float withValue) {
 }
 
 
+bool EffectsManager::hasVideoProgram() {
+  return _videoProgram != 0;
+}
+
+void EffectsManager::beginVideo() {
+  if (_videoProgram)
+    glUseProgram(_videoProgram);
+}
+
+void EffectsManager::endVideo() {
+  if (_videoProgram)
+    glUseProgram(_isActive ? _program : 0);
+}
+
 void EffectsManager::drawDust() {
   if (this->get("dust") && config.effects) {
     // Temporary
@@ -262,6 +286,31 @@ void EffectsManager::init() {
   
   glLinkProgram(_program);
   
+  // Converts video frames from their planes, see Texture::loadVideoFrame()
+  const char* pointerToVideoData = kVideoShaderData;
+  _videoFragment = glCreateShader(GL_FRAGMENT_SHADER);
+  glShaderSource(_videoFragment, 1, &pointerToVideoData, NULL);
+  glCompileShader(_videoFragment);
+  
+  _videoProgram = glCreateProgram();
+  glAttachShader(_videoProgram, _videoFragment);
+  glLinkProgram(_videoProgram);
+  
+  GLint linked;
+  glGetProgramiv(_videoProgram, GL_LINK_STATUS, &linked);
+  if (linked) {
+    glUseProgram(_videoProgram);
+    glUniform1i(glGetUniformLocation(_videoProgram, "PlaneY"), 0);
+    glUniform1i(glGetUniformLocation(_videoProgram, "PlaneU"), 1);
+    glUniform1i(glGetUniformLocation(_videoProgram, "PlaneV"), 2);
+    glUseProgram(0);
+  } else {
+    // Frames will be converted on the CPU instead
+    Log::instance().warning(kModEffects, "%s", kString17012);
+    glDeleteProgram(_videoProgram);
+    _videoProgram = 0;
+  }
+  
   _isInitialized = true;
   
   // Initialize dust
@@ -80,6 +80,7 @@ extern "C" const unsigned char kDustData[];
 
 // Reference to embedded shader data
 extern "C" const char kShaderData[];
+extern "C" const char kVideoShaderData[];
 
 ////////////////////////////////////////////////////////////
 // Interface - Singleton class
@@ -92,6 +93,8 @@ class EffectsManager : public Configurable<effects::Settings> {
   
   GLuint _fragment;
   GLuint _program;
+  GLuint _videoFragment;
+  GLuint _videoProgram; // Zero if it failed to link
   DGDustData _dustData;
   DGParticle _particles[kEffectsMaxDust];
   Texture* _dustTexture;
@@ -115,6 +118,13 @@ public:
     return effectsManager;
   }
   
+  // Checks
+  bool hasVideoProgram();
+  
+  // Frames of planar textures are drawn between these two, see Texture
+  void beginVideo();
+  void endVideo();
+  
   void drawDust();
   void init();
   void loadSettings(const SettingCollection& theSettings);
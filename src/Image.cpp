@@ -18,6 +18,7 @@
 #include "Config.h"
 #include "Image.h"
 #include "Texture.h"
+#include "TextureManager.h"
 
 namespace dagon {
 
@@ -26,7 +27,8 @@ namespace dagon {
 ////////////////////////////////////////////////////////////
 
 Image::Image() :
-config(Config::instance())
+config(Config::instance()),
+textureManager(TextureManager::instance())
 {
   _hasTexture = false;
   _rect = ZeroRect;
@@ -34,12 +36,23 @@ config(Config::instance())
 }
 
 Image::Image(const std::string &fromFileName) :
-config(Config::instance())
+config(Config::instance()),
+textureManager(TextureManager::instance())
 {
+  _hasTexture = false;
   this->setTexture(fromFileName);
   this->setType(kObjectImage);
 }
 
+////////////////////////////////////////////////////////////
+// Implementation - Destructor
+////////////////////////////////////////////////////////////
+
+Image::~Image() {
+  if (_hasTexture)
+    textureManager.releaseImage(_attachedTexture);
+}
+
 ////////////////////////////////////////////////////////////
 // Implementation - Checks
 ////////////////////////////////////////////////////////////
@@ -84,21 +97,29 @@ void Image::setSize(float width, float height) {
 }
 
 void Image::setTexture(const std::string &fromFileName) {
-  // TODO: Important! We should determine first if the texture already exists
-  // to avoid repeating resources. Eventually, this would be done via the
-  // resource manager.
-  // FIXME: These textures are immediately loaded which isn't very efficient.
-
-  _attachedTexture = new Texture;
-  _attachedTexture->setResource(config.path(kPathResources, fromFileName,
-                                            kObjectImage).c_str());
-  _attachedTexture->loadBitmap();
-  if (_attachedTexture->isBitmapLoaded()) {
+  // Images using the same file share the texture
+  if (_hasTexture)
+    textureManager.releaseImage(_attachedTexture);
+  _attachedTexture = textureManager.acquireImage(config.path(kPathResources,
+                                                             fromFileName,
+                                                             kObjectImage));
+  
+  // Only the size is needed for now, the bitmap is decoded when first drawn
+  int width, height;
+  if (textureManager.imageSize(_attachedTexture, width, height)) {
     _rect.origin = ZeroPoint;
-    _rect.size = MakeSize(_attachedTexture->width(),
-                          _attachedTexture->height());
+    _rect.size = MakeSize(width, height);
     _calculateCoordinates();
-    _attachedTexture->unloadBitmap();
+  } else {
+    // Formats we can't probe are decoded right away
+    _attachedTexture->loadBitmap();
+    if (_attachedTexture->isBitmapLoaded()) {
+      _rect.origin = ZeroPoint;
+      _rect.size = MakeSize(_attachedTexture->width(),
+                            _attachedTexture->height());
+      _calculateCoordinates();
+      _attachedTexture->unloadBitmap();
+    }
   }
 
   _hasTexture = true;
@@ -31,6 +31,7 @@ namespace dagon {
 
 class Config;
 class Texture;
+class TextureManager;
 
 ////////////////////////////////////////////////////////////
 // Interface
@@ -40,7 +41,7 @@ class Image : public Object {
  public:
   Image();
   Image(const std::string &fromFileName);
-  ~Image() {};
+  ~Image();
   
   // Checks
   bool hasTexture();
@@ -62,6 +63,7 @@ class Image : public Object {
   
  private:
   Config& config;
+  TextureManager& textureManager;
   
   float _arrayOfCoordinates[8];
   Texture* _attachedTexture;
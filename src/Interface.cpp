@@ -65,7 +65,8 @@ void Interface::drawCursor() {
       cursorManager.updateFade(); // Process fade (supported only with bitmaps)
       cursorManager.bindImage();
       renderManager.setAlpha(cursorManager.fadeLevel());
-      renderManager.drawSlide(cursorManager.arrayOfCoords());
+      renderManager.drawSlide(cursorManager.arrayOfCoords(),
+                              cursorManager.arrayOfTexCoords());
     }
     else {
       Point position = cursorManager.position();
@@ -103,6 +104,9 @@ void Interface::drawOverlays() {
   if (!_arrayOfOverlays.empty()) {
     std::vector<Overlay*>::iterator itOverlay;
     
+    // Most images share a few atlas pages, so we only bind when it changes
+    GLuint boundTexture = 0;
+    
     itOverlay = _arrayOfOverlays.begin();
     
     while (itOverlay != _arrayOfOverlays.end()) {
@@ -118,9 +122,14 @@ void Interface::drawOverlays() {
               button->updateFade();
               
               if (button->hasTexture()) {
+                Texture* texture = button->texture();
                 renderManager.setAlpha(button->fadeLevel());
-                button->texture()->bind();
-                renderManager.drawSlide(button->arrayOfCoordinates());
+                if (!texture->ident() || texture->ident() != boundTexture) {
+                  texture->bind();
+                  boundTexture = texture->ident();
+                }
+                renderManager.drawSlide(button->arrayOfCoordinates(),
+                                        texture->texCoords());
               }
               
               if (button->hasText()) {
@@ -132,6 +141,7 @@ void Interface::drawOverlays() {
                   renderManager.setColor(button->textColor());
                 button->font()->print(position.x, position.y, button->text().c_str());
                 renderManager.setColor(kColorWhite); // Reset the color
+                boundTexture = 0; // Fonts bind their own textures
               }
             }
           } while ((*itOverlay)->iterateButtons());
@@ -147,9 +157,14 @@ void Interface::drawOverlays() {
             Image* image = (*itOverlay)->currentImage();
             if (image->isEnabled()) {
               image->updateFade(); // Perform any necessary updates
-              image->texture()->bind();
+              Texture* texture = image->texture();
+              if (!texture->ident() || texture->ident() != boundTexture) {
+                texture->bind();
+                boundTexture = texture->ident();
+              }
               renderManager.setAlpha(image->fadeLevel());
-              renderManager.drawSlide(image->arrayOfCoordinates());
+              renderManager.drawSlide(image->arrayOfCoordinates(),
+                                      texture->texCoords());
             }
           } while ((*itOverlay)->iterateImages());
         }
@@ -44,6 +44,13 @@
 #define kString10003 "Error while loading compressed image"
 #define kString10004 "Unsupported number of channels in image"
 #define kString10005 "No resource found for texture"
+#define kString10006 "Uploading textures through pixel buffers"
+#define kString10007 "Pixel buffers not supported, uploads will block"
+#define kString10008 "Textures in video memory"
+#define kString10009 "Could not write transcoded texture"
+#define kString10010 "Selected texture tier"
+#define kString10011 "matches the display"
+#define kString10012 "limited by the memory budget"
 
 // Render module
 #define kString11001 "Initializing renderer..."
@@ -134,6 +141,11 @@
 #define kString17008 "Error parsing stream headers"
 #define kString17009 "End of file while searching for codec headers"
 #define kString17010 "Resource not set in video object"
+#define kString17011 "Converting frames with"
+#define kString17012 "Could not link the video shader"
+#define kString17013 "Could not write video index"
+#define kString17014 "Only 4:2:0 video is supported"
+#define kString17015 "No Theora stream found"
 
 // SDL errors
 #define kString18001 "Could not create mutex"
@@ -75,6 +75,10 @@ void RenderManager::init() {
   
   _alphaEnabled = true;
   
+  // Filter across the edges of node panoramas
+  if (GLEW_VERSION_3_2 || GLEW_ARB_seamless_cube_map)
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  
   // WARNING: This next setting could make things slower
   //glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   
@@ -238,6 +242,50 @@ void RenderManager::disableTextures() {
   }
 }
 
+void RenderManager::drawCube(GLuint cubeMap, int faces) {
+  // Same corners as the faces drawn by drawPolygon, in the order of their
+  // coordinates in the bitmap
+  static const GLfloat vertices[] = {
+    -1,  1, -1,   1,  1, -1,   1, -1, -1,  -1, -1, -1, // North
+     1,  1, -1,   1,  1,  1,   1, -1,  1,   1, -1, -1, // East
+     1,  1,  1,  -1,  1,  1,  -1, -1,  1,   1, -1,  1, // South
+    -1,  1,  1,  -1,  1, -1,  -1, -1, -1,  -1, -1,  1, // West
+    -1,  1,  1,   1,  1,  1,   1,  1, -1,  -1,  1, -1, // Up
+    -1, -1, -1,   1, -1, -1,   1, -1,  1,  -1, -1,  1  // Down
+  };
+  
+  // Directions are mirrored on Z, see the slots in Texture
+  static GLfloat directions[72];
+  static bool hasDirections = false;
+  if (!hasDirections) {
+    for (int i = 0; i < 72; i += 3) {
+      directions[i] = vertices[i];
+      directions[i + 1] = vertices[i + 1];
+      directions[i + 2] = -vertices[i + 2];
+    }
+    hasDirections = true;
+  }
+  
+  glDisable(GL_TEXTURE_2D);
+  glEnable(GL_TEXTURE_CUBE_MAP);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMap);
+  
+  glTexCoordPointer(3, GL_FLOAT, 0, directions);
+  glVertexPointer(3, GL_FLOAT, 0, vertices);
+  if (faces == 0x3F) {
+    glDrawArrays(GL_QUADS, 0, 24);
+  } else {
+    for (int i = 0; i < 6; i++) {
+      if (faces & (1 << i))
+        glDrawArrays(GL_QUADS, i * 4, 4);
+    }
+  }
+  
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  glDisable(GL_TEXTURE_CUBE_MAP);
+  glEnable(GL_TEXTURE_2D);
+}
+
 void RenderManager::drawHelper(int xPosition, int yPosition, bool animate) {
   glDisable(GL_LINE_SMOOTH);
   
@@ -433,13 +481,26 @@ void RenderManager::drawPostprocessedView() {
   }
 }
 
+void RenderManager::drawQuads(float* withArrayOfVertices, float* andTexCoords,
+                              int numOfQuads) {
+  if (_texturesEnabled)
+    glTexCoordPointer(2, GL_FLOAT, 0, andTexCoords);
+  
+  glVertexPointer(3, GL_FLOAT, 0, withArrayOfVertices);
+  glDrawArrays(GL_QUADS, 0, numOfQuads * 4);
+}
+
 void RenderManager::drawSlide(float* withArrayOfCoordinates) {
+  GLfloat texCoords[] = {0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f};
+  this->drawSlide(withArrayOfCoordinates, texCoords);
+}
+
+void RenderManager::drawSlide(float* withArrayOfCoordinates,
+                              float* andTexCoords) {
   glPushMatrix();
   
-  if (_texturesEnabled) {
-    GLfloat texCoords[] = {0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f};
-    glTexCoordPointer(2, GL_FLOAT, 0, texCoords);
-  }
+  if (_texturesEnabled)
+    glTexCoordPointer(2, GL_FLOAT, 0, andTexCoords);
   
   glVertexPointer(2, GL_FLOAT, 0, withArrayOfCoordinates);
   glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -106,10 +106,17 @@ public:
   void disableAlpha();
   void disablePostprocess();
   void disableTextures();
+  // Draws the panorama of a node in one call. Faces are bits in the order
+  // of the slots of the cube map, all of them by default.
+  void drawCube(GLuint cubeMap, int faces = 0x3F);
   void drawHelper(int xPosition, int yPosition, bool animate);
   void drawPolygon(std::vector<int> withArrayOfCoordinates, unsigned int onFace);
   void drawPostprocessedView(); // Expects orthogonal mode
+  // Textured quads in space, with the texture already bound
+  void drawQuads(float* withArrayOfVertices, float* andTexCoords,
+                 int numOfQuads);
   void drawSlide(float* withArrayOfCoordinates);
+  void drawSlide(float* withArrayOfCoordinates, float* andTexCoords);
   void setAlpha(float alpha);
   void setColor(uint32_t color, float alpha = 0);
   uint32_t    testColor(int xPosition, int yPosition);
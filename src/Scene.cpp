@@ -20,6 +20,7 @@
 #include "CameraManager.h"
 #include "Config.h"
 #include "CursorManager.h"
+#include "EffectsManager.h"
 #include "Font.h"
 #include "Log.h"
 #include "Node.h"
@@ -29,6 +30,7 @@
 #include "Script.h"
 #include "Spot.h"
 #include "Texture.h"
+#include "TextureTiles.h"
 #include "VideoManager.h"
 
 #include "State.h"
@@ -46,7 +48,9 @@ Scene::Scene() :
 cameraManager(CameraManager::instance()),
 config(Config::instance()),
 cursorManager(CursorManager::instance()),
+effectsManager(EffectsManager::instance()),
 renderManager(RenderManager::instance()),
+textureTiles(TextureTiles::instance()),
 videoManager(VideoManager::instance())
 {
   _canDrawSpots = false;
@@ -91,30 +95,55 @@ void Scene::drawSpots(bool disableVideos) {
       currentNode->updateFade();
       renderManager.setAlpha(currentNode->fadeLevel());
       
+      // The faces of the node share a cube map, drawn once with the first
+      // of them. Spots added after the faces are drawn on top as usual.
+      TextureCube* drawnCube = NULL;
+      textureTiles.update(currentNode);
+      
       currentNode->beginIteratingSpots();
       do {
         Spot* spot = currentNode->currentSpot();
         
         if (spot->hasTexture() && spot->isEnabled()) {
-          if (spot->texture()->isLoaded()) {
+          TextureCube* cube = spot->texture()->cube();
+          int face = cube ? spot->texture()->cubeFace() : 0;
+          if (cube && (cube->faces & (1 << face))) {
+            // Faces are drawn from the cube as soon as they're in
+            if (cube != drawnCube) {
+              renderManager.drawCube(cube->ident, cube->faces);
+              for (int i = 0; i < 6; i++) {
+                if (cube->faces & (1 << i)) {
+                  cube->arrayOfFaces[i]->markUsed();
+                  textureTiles.draw(cube->arrayOfFaces[i]);
+                }
+              }
+              drawnCube = cube;
+            }
+          }
+          // Until loaded, faces may be drawn with a preview
+          else if ((spot->texture()->isLoaded() && !cube) ||
+                   spot->texture()->hasPreview()) {
 			// FIXME: This was the culprit of a crash that should be investigated someday
             if (spot->hasVideo()) {
               // If it has a video, we need to check if it's playing
               if (spot->isPlaying()) { // FIXME: Must stop the spot later!
-                if (spot->video()->hasNewFrame() && !disableVideos) {
-                  DGFrame* frame = spot->video()->currentFrame();
-                  Texture* texture = spot->texture();
-                  texture->loadRawData(frame->data, frame->width, frame->height);
-                }
+                if (spot->video()->hasNewFrame() && !disableVideos)
+                  spot->texture()->loadVideoFrame(spot->video());
                 
+                bool isPlanar = spot->texture()->isPlanar();
+                if (isPlanar)
+                  effectsManager.beginVideo();
                 spot->texture()->bind();
                 renderManager.drawPolygon(spot->arrayOfCoordinates(), spot->face());
+                if (isPlanar)
+                  effectsManager.endVideo();
               }
             }
             else {
               // Draw right away...
               spot->texture()->bind();
               renderManager.drawPolygon(spot->arrayOfCoordinates(), spot->face());
+              textureTiles.draw(spot->texture());
             }
           }
         }
@@ -260,10 +289,8 @@ void Scene::cancelCutscene() {
 
 bool Scene::drawCutscene() {
   if (_cutscene.isPlaying()) {
-    if (_cutscene.hasNewFrame()) {
-      DGFrame* frame = _cutscene.currentFrame();
-      _cutsceneTexture->loadRawData(frame->data, frame->width, frame->height);
-    }
+    if (_cutscene.hasNewFrame())
+      _cutsceneTexture->loadVideoFrame(&_cutscene);
     
     _cutsceneTexture->bind();
     
@@ -278,7 +305,11 @@ bool Scene::drawCutscene() {
     renderManager.enablePostprocess();
     cameraManager.beginOrthoView();
     renderManager.enableTextures();
+    if (_cutsceneTexture->isPlanar())
+      effectsManager.beginVideo();
     renderManager.drawSlide(coords);
+    if (_cutsceneTexture->isPlanar())
+      effectsManager.endVideo();
     renderManager.disablePostprocess();
     renderManager.drawPostprocessedView();
     
@@ -297,8 +328,7 @@ void Scene::loadCutscene(const char* fileName) {
   if (_cutscene.isLoaded()) {
     _cutscene.play();
     
-    DGFrame* frame = _cutscene.currentFrame();
-    _cutsceneTexture->loadRawData(frame->data, frame->width, frame->height);
+    _cutsceneTexture->loadVideoFrame(&_cutscene);
     
     _isCutsceneLoaded = true;
   }
@@ -29,11 +29,13 @@ namespace dagon {
 class CameraManager;
 class Config;
 class CursorManager;
+class EffectsManager;
 class RenderManager;
 class Room;
 class Spot;
 class State;
 class Texture;
+class TextureTiles;
 class VideoManager;
 
 ////////////////////////////////////////////////////////////
@@ -46,7 +48,9 @@ class Scene {
   CameraManager& cameraManager;
   Config& config;
   CursorManager& cursorManager;
+  EffectsManager& effectsManager;
   RenderManager& renderManager;
+  TextureTiles& textureTiles;
   VideoManager& videoManager;
   
   // Other classes
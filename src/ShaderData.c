@@ -149,3 +149,27 @@ const char kShaderData[] =
   "\n     "
   "\n     gl_FragColor = pass;"
   "\n }";
+
+/*
+ * Converts video frames, uploaded as three planes, to RGB. Same coefficients
+ * as VideoConverter, including the bias of the luma.
+ */
+
+const char kVideoShaderData[] =
+  "\n uniform sampler2D PlaneY;"
+  "\n uniform sampler2D PlaneU;"
+  "\n uniform sampler2D PlaneV;"
+  "\n "
+  "\n void main() {"
+  "\n     vec2 uv = gl_TexCoord[0].xy;"
+  "\n     "
+  "\n     float y = 1.169 * (texture2D(PlaneY, uv).r * 255.0 - 16.0) + 4.0 / 256.0;"
+  "\n     float u = texture2D(PlaneU, uv).r * 255.0 - 128.0;"
+  "\n     float v = texture2D(PlaneV, uv).r * 255.0 - 128.0;"
+  "\n     "
+  "\n     vec3 color = vec3(y + 1.628 * v,"
+  "\n                       y - 0.393 * u - 0.841 * v,"
+  "\n                       y + 2.042 * u);"
+  "\n     "
+  "\n     gl_FragColor = vec4(clamp(color / 255.0, 0.0, 1.0), 1.0) * gl_Color;"
+  "\n }";
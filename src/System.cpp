@@ -31,6 +31,10 @@ void System::browse(const char* url) {
   log.warning(kModSystem, "Browsing is currently disabled");
 }
 
+void System::drawableSize(int& width, int& height) {
+  SDL_GL_GetDrawableSize(_window, &width, &height);
+}
+
 #ifdef DAGON_MAC
 namespace {
 #include <CoreFoundation/CoreFoundation.h>
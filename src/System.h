@@ -51,6 +51,8 @@ public:
   ~System() {};
   
   void browse(const char* url);
+  // Size in pixels, which is larger than the window on high-DPI displays
+  void drawableSize(int& width, int& height);
   void findPaths();
   bool init();
   void setTitle(const char* title);
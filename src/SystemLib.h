@@ -24,6 +24,12 @@
 ////////////////////////////////////////////////////////////
 
 #include "Control.h"
+#include "Language.h"
+#include "Log.h"
+#include "TextureManager.h"
+#include "TextureTiles.h"
+#include "TextureUploader.h"
+#include "VideoConverter.h"
 
 namespace dagon {
 
@@ -37,11 +43,152 @@ static int SystemLibBrowse(lua_State *L) {
   return 0;
 }
 
+static int SystemLibImageCacheStats(lua_State *L) {
+  // Returns the hits and misses of the shared image textures, and the bytes
+  // of video memory they currently save
+  lua_pushnumber(L, TextureManager::instance().imageHits());
+  lua_pushnumber(L, TextureManager::instance().imageMisses());
+  lua_pushnumber(L, TextureManager::instance().imageSavedBytes());
+  
+  return 3;
+}
+
 static int SystemLibInit(lua_State *L) {
   // Unused
   return 0;
 }
 
+static int SystemLibPrefetchStats(lua_State *L) {
+  // Returns the hits and misses of the texture prefetcher
+  lua_pushnumber(L, TextureManager::instance().prefetchHits());
+  lua_pushnumber(L, TextureManager::instance().prefetchMisses());
+  
+  return 2;
+}
+
+static int SystemLibSwitchLatency(lua_State *L) {
+  // Returns the milliseconds it took to upload every texture of the node
+  // after the last switch
+  lua_pushnumber(L, TextureManager::instance().switchLatency());
+  
+  return 1;
+}
+
+static int SystemLibTextureReport(lua_State *L) {
+  // Meant for the console, logs the textures taking video memory, largest
+  // first, and the time each one took to load
+  std::vector<TextureStats> arrayOfStats;
+  TextureManager::instance().textureStats(arrayOfStats);
+  
+  size_t bytes = 0;
+  int count = 0;
+  std::vector<TextureStats>::iterator it = arrayOfStats.begin();
+  while (it != arrayOfStats.end() && it->residentBytes) {
+    bytes += it->residentBytes;
+    count++;
+    ++it;
+  }
+  
+  Log& log = Log::instance();
+  log.info(kModTexture, "%s: %d (%.1f MB)", kString10008, count,
+           bytes / 1048576.0);
+  
+  for (it = arrayOfStats.begin(); it != arrayOfStats.end() &&
+       it->residentBytes; ++it) {
+    log.info(kModTexture, "%s [%d]: %.1f KB, decode %.1f ms, "
+             "upload %.1f ms, frame %u, evicted %d", it->resource.c_str(),
+             it->indexInBundle, it->residentBytes / 1024.0, it->decodeTime,
+             it->uploadTime, it->lastUsedFrame, it->evictionCount);
+  }
+  
+  return 0;
+}
+
+static int SystemLibTextureStats(lua_State *L) {
+  // Returns an array with a table per texture, largest first
+  std::vector<TextureStats> arrayOfStats;
+  TextureManager::instance().textureStats(arrayOfStats);
+  
+  lua_createtable(L, static_cast<int>(arrayOfStats.size()), 0);
+  for (size_t i = 0; i < arrayOfStats.size(); i++) {
+    const TextureStats& stats = arrayOfStats[i];
+    lua_createtable(L, 0, 7);
+    lua_pushstring(L, stats.resource.c_str());
+    lua_setfield(L, -2, "resource");
+    lua_pushnumber(L, stats.indexInBundle);
+    lua_setfield(L, -2, "index");
+    lua_pushnumber(L, stats.residentBytes);
+    lua_setfield(L, -2, "residentBytes");
+    lua_pushnumber(L, stats.decodeTime);
+    lua_setfield(L, -2, "decodeTime");
+    lua_pushnumber(L, stats.uploadTime);
+    lua_setfield(L, -2, "uploadTime");
+    lua_pushnumber(L, stats.lastUsedFrame);
+    lua_setfield(L, -2, "lastUsedFrame");
+    lua_pushnumber(L, stats.evictionCount);
+    lua_setfield(L, -2, "evictions");
+    lua_rawseti(L, -2, static_cast<int>(i) + 1);
+  }
+  
+  return 1;
+}
+
+static int SystemLibTileStats(lua_State *L) {
+  // Returns the full resolution tiles resident around the view, the pages
+  // holding them and their bytes of video memory
+  lua_pushnumber(L, TextureTiles::instance().numTiles());
+  lua_pushnumber(L, TextureTiles::instance().numPages());
+  lua_pushnumber(L, TextureTiles::instance().residentBytes());
+  
+  return 3;
+}
+
+static int SystemLibUploadStats(lua_State *L) {
+  // Returns the bytes uploaded during the last frame and the milliseconds
+  // spent waiting for pixel buffers
+  lua_pushnumber(L, TextureUploader::instance().bytesLastFrame());
+  lua_pushnumber(L, TextureUploader::instance().stallLastFrame());
+  
+  return 2;
+}
+
+static int SystemLibVideoBenchmark(lua_State *L) {
+  // Meant for the console, logs the milliseconds per frame of each frame
+  // conversion kernel supported by the CPU at common resolutions. Also
+  // returns them, as an array with a table per kernel and resolution.
+  const int sizes[][2] = {{854, 480}, {1280, 720}, {1920, 1080}};
+  int frames = lua_isnumber(L, 1) ? static_cast<int>(lua_tonumber(L, 1)) : 30;
+  
+  Log& log = Log::instance();
+  int index = 1;
+  lua_newtable(L);
+  for (int kernel = 0; kernel < kVideoNumKernels; kernel++) {
+    if (!VideoConverter::isSupported(kernel))
+      continue;
+    
+    for (int i = 0; i < 3; i++) {
+      double time = VideoConverter::benchmark(kernel, sizes[i][0],
+                                              sizes[i][1], frames);
+      log.info(kModVideo, "%s: %s, %dx%d, %.2f ms", kString17011,
+               VideoConverter::kernelName(kernel), sizes[i][0], sizes[i][1],
+               time);
+      
+      lua_createtable(L, 0, 4);
+      lua_pushstring(L, VideoConverter::kernelName(kernel));
+      lua_setfield(L, -2, "kernel");
+      lua_pushnumber(L, sizes[i][0]);
+      lua_setfield(L, -2, "width");
+      lua_pushnumber(L, sizes[i][1]);
+      lua_setfield(L, -2, "height");
+      lua_pushnumber(L, time);
+      lua_setfield(L, -2, "time");
+      lua_rawseti(L, -2, index++);
+    }
+  }
+  
+  return 1;
+}
+
 static int SystemLibRun(lua_State *L) {
   Control::instance().run();
   
@@ -74,11 +221,19 @@ static int SystemShowHelpers(lua_State *L) {
 
 static const struct luaL_reg SystemLib [] = {
   {"browse", SystemLibBrowse},
+  {"imageCacheStats", SystemLibImageCacheStats},
   {"init", SystemLibInit},
+  {"prefetchStats", SystemLibPrefetchStats},
   {"run", SystemLibRun},
+  {"switchLatency", SystemLibSwitchLatency},
   {"update", SystemLibUpdate},
   {"terminate", SystemLibTerminate},
+  {"textureReport", SystemLibTextureReport},
+  {"textureStats", SystemLibTextureStats},
+  {"tileStats", SystemLibTileStats},
   {"toggleHelpers", SystemShowHelpers},
+  {"uploadStats", SystemLibUploadStats},
+  {"videoBenchmark", SystemLibVideoBenchmark},
   {NULL, NULL}
 };
 
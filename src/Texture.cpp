@@ -17,12 +17,33 @@
 
 #include <string.h>
 #include <fstream>
-//#include <ktx.h>
+
+#include <SDL2/SDL_timer.h>
+
+#include "Platform.h"
+
+#include <sys/stat.h>
+
+#ifdef DAGON_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "Config.h"
+#include "EffectsManager.h"
 #include "Language.h"
 #include "Log.h"
 #include "Texture.h"
+#include "TextureAtlas.h"
+#include "TextureBundle.h"
+#include "TextureCompressor.h"
+#include "TextureManager.h"
+#include "TextureTiles.h"
+#include "TextureUploader.h"
+#include "Video.h"
 #include "stb_image.h"
 
 namespace dagon {
@@ -31,20 +52,157 @@ namespace dagon {
 // Defines
 ////////////////////////////////////////////////////////////
 
-char TEXIdent[] = "KS_TEX"; // We keep this one for backward compatibility
 const char KTXIdent[] = { '\xAB', '\x4B', '\x54', '\x58', '\x20', '\x31', '\x31', '\xBB', '\x0D', '\x0A', '\x1A', '\x0A' };
 
+// KTX 1.1 header, following the identifier
+typedef struct {
+  uint32_t endianness;
+  uint32_t glType;
+  uint32_t glTypeSize;
+  uint32_t glFormat;
+  uint32_t glInternalFormat;
+  uint32_t glBaseInternalFormat;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t numberOfArrayElements;
+  uint32_t numberOfFaces;
+  uint32_t numberOfMipmapLevels;
+  uint32_t bytesOfKeyValueData;
+} KTXHeader;
+
+// Whole texture, in the order of the vertices of slides
+static const GLfloat DefaultTexCoords[] = {
+  0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f
+};
+
+// Slots of the cube map by face. Directions are mirrored on Z when drawing,
+// which leaves every face upright without flipping the bitmaps.
+static const GLenum CubeTargets[] = {
+  GL_TEXTURE_CUBE_MAP_POSITIVE_Z, // North
+  GL_TEXTURE_CUBE_MAP_POSITIVE_X, // East
+  GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, // South
+  GL_TEXTURE_CUBE_MAP_NEGATIVE_X, // West
+  GL_TEXTURE_CUBE_MAP_POSITIVE_Y, // Up
+  GL_TEXTURE_CUBE_MAP_NEGATIVE_Y  // Down
+};
+
+#define kKTXEndianness 0x04030201
+#define kKTXEndiannessSwapped 0x01020304
+
+static uint32_t SwapKTX(uint32_t value) {
+  return ((value & 0xFF) << 24) | ((value & 0xFF00) << 8) |
+         ((value >> 8) & 0xFF00) | (value >> 24);
+}
+
+// Bytes per pixel of uncompressed KTX levels, or zero if not supported
+static size_t PixelSizeKTX(GLenum format, GLenum type) {
+  switch (type) {
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+      return 2;
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+      return 4;
+  }
+  
+  size_t component;
+  switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+      component = 1;
+      break;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT:
+      component = 2;
+      break;
+    case GL_INT:
+    case GL_UNSIGNED_INT:
+    case GL_FLOAT:
+      component = 4;
+      break;
+    default:
+      return 0;
+  }
+  
+  switch (format) {
+    case GL_RED:
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+      return component;
+    case GL_RG:
+    case GL_LUMINANCE_ALPHA:
+      return component * 2;
+    case GL_RGB:
+    case GL_BGR:
+      return component * 3;
+    case GL_RGBA:
+    case GL_BGRA:
+      return component * 4;
+    default:
+      return 0;
+  }
+}
+
 ////////////////////////////////////////////////////////////
 // Implementation - Constructor
 ////////////////////////////////////////////////////////////
 
 Texture::Texture() :
 config(Config::instance()),
-log(Log::instance())
+log(Log::instance()),
+uploader(TextureUploader::instance())
 {
+  _bitmap = NULL;
+  _bitmapSize = 0;
+  _cube = NULL;
+  _cubeFace = 0;
+  _decodeTime = 0;
+  _deflatedBitmap = NULL;
+  _deflatedSize = 0;
+  _depth = 0;
+  _evictionCount = 0;
+  _format = GL_RGB;
+  _hasFailed = false;
   _hasResource = false;
+  _height = 0;
+  _chromaIdents[0] = 0;
+  _chromaIdents[1] = 0;
+  _ident = 0;
+  _indexInBundle = 0;
+  _internalFormat = GL_RGB;
+  _isAtlasable = false;
+  _isAtlased = false;
+  _isBitmapCompressed = false;
+  _isBitmapDeflated = false;
   _isBitmapLoaded = false;
+  _isBitmapMapped = false;
   _isLoaded = false;
+  _isMipmapped = false;
+  _isPlanar = false;
+  _isTiled = false;
+  _lastUsedFrame = 0;
+  _levels = 1;
+  _mapping = NULL;
+  _mappingSize = 0;
+  _type = GL_UNSIGNED_BYTE;
+  _uploadTime = 0;
+  _width = 0;
+  _hasPreview = false;
+  memcpy(_texCoords, DefaultTexCoords, sizeof(_texCoords));
+  _isPreviewCompressed = false;
+  _isPreviewLoaded = false;
+  _previewBitmap = NULL;
+  _previewFormat = GL_RGB;
+  _previewHeight = 0;
+  _previewIdent = 0;
+  _previewLevels = 0;
+  _previewSize = 0;
+  _previewWidth = 0;
+  _residentBytes = 0;
   _usageCount = 0;
   _compressionLevel = config.texCompression;
   this->setType(kObjectTexture);
@@ -55,7 +213,8 @@ log(Log::instance())
 
 Texture::Texture(int withWidth, int andHeight, int andDepth) :
 config(Config::instance()),
-log(Log::instance())
+log(Log::instance()),
+uploader(TextureUploader::instance())
 {
   if (!withWidth)
     withWidth = kDefTexSize;
@@ -84,8 +243,47 @@ log(Log::instance())
   delete[] _bitmap;
   
   // The texture doesn't require a resource, so we make it clear
+  _chromaIdents[0] = 0;
+  _chromaIdents[1] = 0;
+  _cube = NULL;
+  _cubeFace = 0;
+  _decodeTime = 0;
+  _deflatedBitmap = NULL;
+  _deflatedSize = 0;
+  _evictionCount = 0;
+  _format = GL_RGB;
+  _hasFailed = false;
   _hasResource = true;
+  _indexInBundle = 0;
+  _internalFormat = (comp == 4) ? GL_RGBA : GL_RGB;
+  _isAtlasable = false;
+  _isAtlased = false;
+  _isBitmapCompressed = false;
+  _isBitmapDeflated = false;
+  _isBitmapLoaded = false;
+  _isBitmapMapped = false;
   _isLoaded = true;
+  _isMipmapped = false;
+  _isPlanar = false;
+  _isTiled = false;
+  _lastUsedFrame = 0;
+  _levels = 1;
+  _mapping = NULL;
+  _mappingSize = 0;
+  _type = GL_UNSIGNED_BYTE;
+  _uploadTime = 0;
+  _hasPreview = false;
+  memcpy(_texCoords, DefaultTexCoords, sizeof(_texCoords));
+  _isPreviewCompressed = false;
+  _isPreviewLoaded = false;
+  _previewBitmap = NULL;
+  _previewFormat = GL_RGB;
+  _previewHeight = 0;
+  _previewIdent = 0;
+  _previewLevels = 0;
+  _previewSize = 0;
+  _previewWidth = 0;
+  _residentBytes = _width * _height * comp;
   // Since the texture will be loaded only once, we note this
   _usageCount = 1;
   _compressionLevel = config.texCompression;
@@ -108,10 +306,22 @@ Texture::~Texture() {
 // Implementation - Checks
 ////////////////////////////////////////////////////////////
 
+bool Texture::hasPreview() {
+  return _hasPreview;
+}
+
 bool Texture::hasResource() {
   return _hasResource;
 }
 
+bool Texture::hasTiles() {
+  return _isLoaded && _isBitmapLoaded && _canTile();
+}
+
+bool Texture::isAtlased() {
+  return _isAtlased;
+}
+
 bool Texture::isLoaded() {
   return _isLoaded;
 }
@@ -120,14 +330,42 @@ bool Texture::isBitmapLoaded() {
   return _isBitmapLoaded;
 }
 
+bool Texture::isBitmapDeflated() {
+  return _isBitmapDeflated;
+}
+
+bool Texture::isPlanar() {
+  return _isPlanar;
+}
+
+bool Texture::isPreviewLoaded() {
+  return _isPreviewLoaded;
+}
+
 ////////////////////////////////////////////////////////////
 // Implementation - Gets
 ////////////////////////////////////////////////////////////
 
+TextureCube* Texture::cube() {
+  return _cube;
+}
+
+int Texture::cubeFace() {
+  return _cubeFace;
+}
+
+double Texture::decodeTime() {
+  return (_decodeTime * 1000.0) / SDL_GetPerformanceFrequency();
+}
+
 int Texture::depth() {
   return _depth;
 }
 
+int Texture::evictionCount() {
+  return _evictionCount;
+}
+
 int Texture::indexInBundle() {
   return _indexInBundle;
 }
@@ -136,10 +374,34 @@ int Texture::height() {
   return _height;
 }
 
+GLuint Texture::ident() {
+  return _isLoaded ? _ident : 0;
+}
+
+GLint Texture::internalFormat() {
+  return _internalFormat;
+}
+
+unsigned int Texture::lastUsedFrame() {
+  return _lastUsedFrame;
+}
+
+size_t Texture::residentBytes() {
+  return _residentBytes;
+}
+
 std::string Texture::resource() {
   return _resource;
 }
 
+float* Texture::texCoords() {
+  return _texCoords;
+}
+
+double Texture::uploadTime() {
+  return (_uploadTime * 1000.0) / SDL_GetPerformanceFrequency();
+}
+
 unsigned int Texture::usageCount() {
   return _usageCount;
 }
@@ -152,33 +414,70 @@ int Texture::width() {
 // Implementation - Sets
 ////////////////////////////////////////////////////////////
 
+void Texture::increaseEvictionCount() {
+  _evictionCount++;
+}
+
 void Texture::increaseUsageCount() {
   // We only keep track of the usage count if the texture is loaded
   if (_isLoaded)
     _usageCount++;
 }
 
+void Texture::markUsed() {
+  TextureManager& textureManager = TextureManager::instance();
+  _lastUsedFrame = textureManager.frame();
+  textureManager.touchTexture(this);
+}
+
+void Texture::setAtlasable(bool flag) {
+  _isAtlasable = flag;
+}
+
+void Texture::setCube(TextureCube* cube, int face) {
+  _cube = cube;
+  _cubeFace = face;
+}
+
 void Texture::setIndexInBundle(int index) {
   _indexInBundle = index;
 }
 
+void Texture::setMipmapped(bool flag) {
+  _isMipmapped = flag;
+}
+
 void Texture::setResource(std::string fromFileName) {
   _resource = fromFileName;
+  _hasFailed = false;
   _hasResource = true;
 }
 
+void Texture::setTiled(bool flag) {
+  _isTiled = flag;
+}
+
 ////////////////////////////////////////////////////////////
 // Implementation - State changes
 ////////////////////////////////////////////////////////////
 
+// Only called from the thread owning the GL context, which is the only one
+// changing what we bind, so there's no need to lock. Faces of a cube map are
+// drawn along with the whole cube, so only their previews are bound here.
 void Texture::bind() {
-  if (SDL_LockMutex(_mutex) == 0) {
-    if (_isLoaded)
-      glBindTexture(GL_TEXTURE_2D, _ident);
-    SDL_UnlockMutex(_mutex);
-  } else {
-    log.error(kModTexture, "%s", kString18002);
-  }
+  if (_isPlanar) {
+    // Chroma goes to the units the video shader samples it from
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _chromaIdents[0]);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, _chromaIdents[1]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _ident);
+  } else if (_isLoaded && !_cube)
+    glBindTexture(GL_TEXTURE_2D, _ident);
+  else if (_hasPreview)
+    glBindTexture(GL_TEXTURE_2D, _previewIdent);
+  this->markUsed();
 }
 
 void Texture::clear() {
@@ -194,179 +493,242 @@ void Texture::clear() {
   }
 }
 
+bool Texture::copyTile(int column, int row, GLubyte* output) {
+  bool isCopied = false;
+  
+  if (SDL_LockMutex(_mutex) == 0) {
+    if (_isBitmapLoaded && _canTile()) {
+      const GLubyte* level = _bitmap;
+      if (_isBitmapMapped)
+        level += _levelOffsets[0];
+      
+      // Tiles are whole rows of blocks, so they're copied one row at a time
+      int size = TextureCompressor::blockSize(_internalFormat);
+      int blocksWide = _width / 4;
+      int tileBlocks = kTileSize / 4;
+      for (int y = 0; y < tileBlocks; y++) {
+        int offset = ((row * tileBlocks + y) * blocksWide +
+                      column * tileBlocks) * size;
+        memcpy(output + y * tileBlocks * size, level + offset,
+               tileBlocks * size);
+      }
+      isCopied = true;
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+  
+  return isCopied;
+}
+
+void Texture::inflateBitmap() {
+  if (SDL_LockMutex(_mutex) == 0) {
+    Uint64 startTime = SDL_GetPerformanceCounter();
+    if (_isBitmapDeflated)
+      _inflateBitmap();
+    _decodeTime += SDL_GetPerformanceCounter() - startTime;
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+}
+
 void Texture::load() {
+  // Images and buttons ask for their textures every frame
+  if (_isLoaded || _hasFailed)
+    return;
+  
   if (SDL_LockMutex(_mutex) == 0) {
     if (!_isLoaded) {
-      if (!_hasResource) {
-        log.error(kModTexture, "%s: %s", kString10005, this->name().c_str());
-      }
+      Uint64 startTime = SDL_GetPerformanceCounter();
+      
+      // The bitmap may have already been decoded by the preloader
+      if (!_isBitmapLoaded && !_isBitmapDeflated)
+        _decodeBitmap();
       
+      if (_isBitmapDeflated)
+        _inflateBitmap();
+      _decodeTime += SDL_GetPerformanceCounter() - startTime;
+      
+      if (_isBitmapLoaded)
+        _uploadBitmap();
+      
+      // Already logged, once is enough
+      if (!_isLoaded)
+        _hasFailed = true;
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+}
+
+void Texture::loadBitmap() {
+  if (SDL_LockMutex(_mutex) == 0) {
+    Uint64 startTime = SDL_GetPerformanceCounter();
+    if (!_isLoaded && !_isBitmapLoaded && !_isBitmapDeflated)
+      _decodeBitmap();
+    
+    if (_isBitmapDeflated)
+      _inflateBitmap();
+    _decodeTime += SDL_GetPerformanceCounter() - startTime;
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+}
+
+void Texture::loadBitmap(TextureBundle& fromBundle) {
+  if (SDL_LockMutex(_mutex) == 0) {
+    Uint64 startTime = SDL_GetPerformanceCounter();
+    if (!_isLoaded && !_isBitmapLoaded && !_isBitmapDeflated)
+      _decodeBitmap(fromBundle);
+    _decodeTime += SDL_GetPerformanceCounter() - startTime;
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+}
+
+bool Texture::probe() {
+  bool isProbed = false;
+  
+  if (SDL_LockMutex(_mutex) == 0) {
+    if (_isLoaded || _isBitmapLoaded) {
+      isProbed = true;
+    } else {
       FILE* fh = fopen(_resource.c_str(), "rb");
       if (fh != NULL) {
-        char magic[12]; // Used to identity file types
-        if (fread(&magic, sizeof(magic), 1, fh) == 0) {
-          // Couldn't read magic number
-          log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
-        }
+        char magic[sizeof(KTXIdent) + sizeof(KTXHeader)];
+        size_t length = fread(&magic, 1, sizeof(magic), fh);
         
-        if (memcmp(TEXIdent, &magic, 7) == 0) { // Handle our own TEX format
-          TEXMainHeader header;
-          TEXSubHeader subheader;
-          
-          // Read the main header
-          fseek(fh, 8, SEEK_SET); // Skip identifier
-          fread(&header, 1, sizeof(header), fh);
-          _width = static_cast<GLint>(header.width);
-          _height = static_cast<GLint>(header.height);
-          
-          // Skip subheaders based on the index
-          if (_indexInBundle) {
-            for (int i = 0; i < _indexInBundle; i++) {
-              fread(&subheader, 1, sizeof(subheader), fh);
-              fseek(fh, sizeof(char) * subheader.size, SEEK_CUR);
-            }
+        if (TextureBundle::isBundle(magic, length)) {
+          TextureBundle bundle;
+          if (bundle.open(_resource)) {
+            _width = static_cast<GLint>(bundle.width());
+            _height = static_cast<GLint>(bundle.height());
+            isProbed = true;
           }
-          
-          // Read the subheader
-          fread(&subheader, 1, sizeof(subheader), fh);
-          _depth = static_cast<GLuint>(subheader.depth);
-          GLint size = static_cast<GLint>(subheader.size);
-          GLint internalFormat = static_cast<GLint>(subheader.format);
-          
-          // Get the bitmap
-          _bitmap = new GLubyte[size];
-          fread(_bitmap, 1, sizeof(GLubyte) * size, fh);
-          
-          glGenTextures(1, &_ident);
-          glBindTexture(GL_TEXTURE_2D, _ident);
-          
-          // Detect the compression level
-          if (header.compressionLevel) {
-            GLint compressed;
-            glCompressedTexImage2D(GL_TEXTURE_2D, 0, internalFormat,
-                                   _width, _height, 0, size, _bitmap);
-            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED,
-                                     &compressed);
-            if (compressed == GL_TRUE) {
-              _isLoaded = true;
-            } else {
-              log.error(kModTexture, "%s: %s", kString10003, fh);
-            }
-          } else {
-            // Note that we only support RGB textures
-            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, _width, _height,
-                         0, GL_RGB, GL_UNSIGNED_BYTE, _bitmap);
-            _isLoaded = true;
+        } else if (length == sizeof(magic) &&
+                   memcmp(KTXIdent, &magic, sizeof(KTXIdent)) == 0) {
+          KTXHeader header;
+          memcpy(&header, magic + sizeof(KTXIdent), sizeof(header));
+          if (header.endianness == kKTXEndiannessSwapped) {
+            header.pixelWidth = SwapKTX(header.pixelWidth);
+            header.pixelHeight = SwapKTX(header.pixelHeight);
           }
-          
-          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-          delete[] _bitmap;
-        } /*else if (memcmp(KTXIdent, &magic, sizeof(KTXIdent)) == 0) {
-          GLenum target = 0;
-          GLenum error = 0;
-          GLboolean mipmapped = false;
-          KTX_error_code ktxerror;
-
+          _width = static_cast<GLint>(header.pixelWidth);
+          _height = static_cast<GLint>(header.pixelHeight);
+          isProbed = true;
+        } else {
           fseek(fh, 0, SEEK_SET);
-
-          ktxerror = ktxLoadTextureF(fh, &_ident, &target, NULL, &mipmapped, &error, NULL, NULL);
-
-          if (ktxerror == KTX_SUCCESS) {
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-            if (mipmapped) {
-              glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-            } else {
-              glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            }
-
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-            _isLoaded = true;
-          } else {
-            log.error(kModTexture, "KTX load error: %s", ktxerror);
-          }
-        }*/ else { // Let stb_image load the texture
-          if (!_isBitmapLoaded) {
-            fseek(fh, 0, SEEK_SET);
-            int x, y, comp;
-            _bitmap = static_cast<GLubyte*>(stbi_load_from_file(fh, &x, &y,
-                                                                &comp,
-                                                                STBI_default));
+          int x, y, comp;
+          if (stbi_info_from_file(fh, &x, &y, &comp)) {
             _width = x;
             _height = y;
-            _depth = comp;
+            isProbed = true;
           }
-          if (_bitmap) {
-            GLint format = 0, internalFormat = 0;
-            switch (_depth) {
-              case STBI_grey: {
-                format = GL_LUMINANCE;
-                if (_compressionLevel) {
-                  internalFormat = GL_COMPRESSED_LUMINANCE;
-                } else {
-                  internalFormat = GL_LUMINANCE;
-                }
-                break;
-              }
-              case STBI_grey_alpha: {
-                format = GL_LUMINANCE_ALPHA;
-                if (_compressionLevel) {
-                  internalFormat = GL_COMPRESSED_LUMINANCE_ALPHA;
-                } else {
-                  internalFormat = GL_LUMINANCE_ALPHA;
-                }
-                break;
-              }
-              case STBI_rgb: {
-                format = GL_RGB;
-                if (_compressionLevel) {
-                  internalFormat = GL_COMPRESSED_RGB;
-                } else {
-                  internalFormat = GL_RGB;
-                }
-                break;
-              }
-              case STBI_rgb_alpha: {
-                format = GL_RGBA;
-                if (_compressionLevel) {
-                  internalFormat = GL_COMPRESSED_RGBA;
-                } else {
-                  internalFormat = GL_RGBA;
+        }
+        fclose(fh);
+      }
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+  
+  return isProbed;
+}
+
+void Texture::unloadBitmap() {
+  if (SDL_LockMutex(_mutex) == 0) {
+    if (_isBitmapLoaded)
+      _freeBitmap();
+    
+    if (_isBitmapDeflated) {
+      free(_deflatedBitmap);
+      _isBitmapDeflated = false;
+    }
+    
+    if (_isPreviewLoaded) {
+      free(_previewBitmap);
+      _isPreviewLoaded = false;
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+}
+
+void Texture::loadPreview() {
+  if (SDL_LockMutex(_mutex) == 0) {
+    if (!_isLoaded && !_hasPreview && !_isPreviewLoaded && _isBitmapLoaded) {
+      _previewWidth = _width >> kTexturePreviewLevel;
+      _previewHeight = _height >> kTexturePreviewLevel;
+      
+      if (_isBitmapMapped && _isBitmapCompressed &&
+          _levels > kTexturePreviewLevel &&
+          TextureCompressor::blockSize(_internalFormat)) {
+        // Same as below, but levels are interleaved with their sizes. Other
+        // compressed formats are left without a preview.
+        _previewFormat = _internalFormat;
+        _previewLevels = _levels - kTexturePreviewLevel;
+        _previewSize = 0;
+        for (int i = kTexturePreviewLevel; i < _levels; i++)
+          _previewSize += _levelSizes[i];
+        _previewBitmap = static_cast<GLubyte*>(malloc(_previewSize));
+        if (_previewBitmap) {
+          GLubyte* level = _previewBitmap;
+          for (int i = kTexturePreviewLevel; i < _levels; i++) {
+            memcpy(level, _bitmap + _levelOffsets[i], _levelSizes[i]);
+            level += _levelSizes[i];
+          }
+          _isPreviewCompressed = true;
+          _isPreviewLoaded = true;
+        }
+      } else if (_isBitmapCompressed && _levels > kTexturePreviewLevel) {
+        // Copy the stored mipmaps from the preview level down
+        size_t offset = TextureCompressor::chainSize(_internalFormat, _width,
+                                                     _height,
+                                                     kTexturePreviewLevel);
+        _previewFormat = _internalFormat;
+        _previewLevels = _levels - kTexturePreviewLevel;
+        _previewSize = _bitmapSize - static_cast<GLsizei>(offset);
+        _previewBitmap = static_cast<GLubyte*>(malloc(_previewSize));
+        if (_previewBitmap) {
+          memcpy(_previewBitmap, _bitmap + offset, _previewSize);
+          _isPreviewCompressed = true;
+          _isPreviewLoaded = true;
+        }
+      } else if (!_isBitmapCompressed && !_isBitmapMapped &&
+                 _previewWidth && _previewHeight) {
+        // Average blocks of pixels. Note we never compress previews.
+        int scale = 1 << kTexturePreviewLevel;
+        int comp = _bitmapSize / (_width * _height);
+        _previewFormat = _format;
+        _previewLevels = 1;
+        _previewSize = _previewWidth * _previewHeight * comp;
+        _previewBitmap = static_cast<GLubyte*>(malloc(_previewSize));
+        if (_previewBitmap) {
+          for (int y = 0; y < _previewHeight; y++) {
+            for (int x = 0; x < _previewWidth; x++) {
+              for (int c = 0; c < comp; c++) {
+                int sum = 0;
+                for (int j = 0; j < scale; j++) {
+                  const GLubyte* row = _bitmap + ((y * scale + j) * _width +
+                                                  x * scale) * comp + c;
+                  for (int i = 0; i < scale; i++)
+                    sum += row[i * comp];
                 }
-                break;
-              }
-              default: {
-                log.warning(kModTexture, "%s: (%s) %d", kString10004,
-                            _resource.c_str(), _depth);
-                break;
+                _previewBitmap[(y * _previewWidth + x) * comp + c] =
+                  static_cast<GLubyte>(sum / (scale * scale));
               }
             }
-            glGenTextures(1, &_ident);
-            glBindTexture(GL_TEXTURE_2D, _ident);
-            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, _width, _height,
-                         0, format, GL_UNSIGNED_BYTE, _bitmap);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            free(_bitmap);
-            _isBitmapLoaded = false;
-            _isLoaded = true;
-          } else {
-            // Nothing loaded
-            log.error(kModTexture, "%s: (%s) %s", kString10002,
-                      _resource.c_str(), stbi_failure_reason());
           }
+          _isPreviewCompressed = false;
+          _isPreviewLoaded = true;
         }
-        fclose(fh);
-      } else {
-        // File not found
-        log.error(kModTexture, "%s: %s", kString10001, _resource.c_str());
       }
     }
     SDL_UnlockMutex(_mutex);
@@ -375,23 +737,83 @@ void Texture::load() {
   }
 }
 
-void Texture::loadBitmap() {
-  FILE* fh = fopen(_resource.c_str(), "rb");
-  if (fh != NULL) {
-    int x, y, comp;
-    _bitmap = static_cast<GLubyte*>(stbi_load_from_file(fh, &x, &y,
-                                                        &comp, STBI_default));
-    _width = x;
-    _height = y;
-    _depth = comp;
-    _isBitmapLoaded = true;
+void Texture::loadPreview(TextureBundle& fromBundle) {
+  if (SDL_LockMutex(_mutex) == 0) {
+    if (!_isLoaded && !_hasPreview && !_isPreviewLoaded && !_isBitmapLoaded &&
+        !_isBitmapDeflated && _indexInBundle < fromBundle.numTextures() &&
+        fromBundle.compressionLevel() == 1) {
+      // Only possible with stored mipmaps that aren't deflated
+      const TextureBundleEntry& entry = fromBundle.entry(_indexInBundle);
+      int width = fromBundle.width();
+      int height = fromBundle.height();
+      size_t offset = TextureCompressor::chainSize(entry.format, width, height,
+                                                   kTexturePreviewLevel);
+      
+      if (entry.levels > kTexturePreviewLevel && offset &&
+          TextureCompressor::chainSize(entry.format, width, height,
+                                       entry.levels) == entry.size) {
+        _previewWidth = width >> kTexturePreviewLevel;
+        _previewHeight = height >> kTexturePreviewLevel;
+        _previewFormat = entry.format;
+        _previewLevels = entry.levels - kTexturePreviewLevel;
+        _previewSize = static_cast<GLsizei>(entry.size - offset);
+        _previewBitmap = static_cast<GLubyte*>(malloc(_previewSize));
+        if (_previewBitmap && fromBundle.read(_indexInBundle, offset,
+                                              _previewSize, _previewBitmap)) {
+          _isPreviewCompressed = true;
+          _isPreviewLoaded = true;
+        } else {
+          free(_previewBitmap);
+        }
+      }
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
   }
 }
 
-void Texture::unloadBitmap() {
-  if (_isBitmapLoaded) {
-    free(_bitmap);
-    _isBitmapLoaded = false;
+void Texture::uploadPreview() {
+  if (SDL_LockMutex(_mutex) == 0) {
+    if (_isPreviewLoaded && !_isLoaded && !_hasPreview) {
+      glGenTextures(1, &_previewIdent);
+      glBindTexture(GL_TEXTURE_2D, _previewIdent);
+      
+      GLubyte* level = _previewBitmap;
+      GLsizei width = _previewWidth, height = _previewHeight;
+      for (int i = 0; i < _previewLevels; i++) {
+        if (_isPreviewCompressed) {
+          GLsizei size = static_cast<GLsizei>(
+            TextureCompressor::levelSize(_previewFormat, width, height));
+          uploader.compressedTexImage2D(GL_TEXTURE_2D, i, _previewFormat,
+                                        width, height, size, level);
+          level += size;
+        } else {
+          uploader.texImage2D(GL_TEXTURE_2D, i, _previewFormat,
+                              width, height, _previewFormat,
+                              GL_UNSIGNED_BYTE, _previewSize, level);
+        }
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+      }
+      
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, _previewLevels - 1);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                      _previewLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR :
+                                           GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      _hasPreview = true;
+    }
+    
+    if (_isPreviewLoaded) {
+      free(_previewBitmap);
+      _isPreviewLoaded = false;
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
   }
 }
 
@@ -405,60 +827,10 @@ void Texture::loadFromMemory(const unsigned char* dataToLoad, long size) {
       _width = x;
       _height = y;
       _depth = comp;
-      
-      GLint format = 0, internalFormat = 0;
-      switch (comp) {
-        case STBI_grey: {
-          format = GL_LUMINANCE;
-          if (_compressionLevel) {
-            internalFormat = GL_COMPRESSED_LUMINANCE;
-          } else {
-            internalFormat = GL_LUMINANCE;
-          }
-          break;
-        }
-        case STBI_grey_alpha: {
-          format = GL_LUMINANCE_ALPHA;
-          if (_compressionLevel) {
-            internalFormat = GL_COMPRESSED_LUMINANCE_ALPHA;
-          } else {
-            internalFormat = GL_LUMINANCE_ALPHA;
-          }
-          break;
-        }
-        case STBI_rgb: {
-          format = GL_RGB;
-          if (_compressionLevel) {
-            internalFormat = GL_COMPRESSED_RGB;
-          } else {
-            internalFormat = GL_RGB;
-          }
-          break;
-        }
-        case STBI_rgb_alpha: {
-          format = GL_RGBA;
-          if (_compressionLevel) {
-            internalFormat = GL_COMPRESSED_RGBA;
-          } else {
-            internalFormat = GL_RGBA;
-          }
-          break;
-        }
-        default: {
-          log.warning(kModTexture, "%s: %d", kString10004, comp);
-          break;
-        }
-      }
-      glGenTextures(1, &_ident);
-      glBindTexture(GL_TEXTURE_2D, _ident);
-      glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, _width, _height,
-                   0, format, GL_UNSIGNED_BYTE, _bitmap);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-      _isLoaded = true;
-      free(_bitmap);
+      _levels = 1;
+      _setFormats(comp);
+      _isBitmapLoaded = true;
+      _uploadBitmap();
     } else {
       // Nothing loaded
       log.error(kModTexture, "%s: %s", kString10002, stbi_failure_reason());
@@ -473,8 +845,9 @@ void Texture::loadRawData(const unsigned char* dataToLoad,
   if (!_isLoaded) {
     glGenTextures(1, &_ident);
     glBindTexture(GL_TEXTURE_2D, _ident);
-    glTexImage2D(GL_TEXTURE_2D, 0, 3, withWidth, andHeight,
-                 0, GL_BGR, GL_UNSIGNED_BYTE, dataToLoad);
+    uploader.texImage2D(GL_TEXTURE_2D, 0, 3, withWidth, andHeight,
+                        GL_BGR, GL_UNSIGNED_BYTE,
+                        withWidth * andHeight * 3, dataToLoad);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -482,16 +855,28 @@ void Texture::loadRawData(const unsigned char* dataToLoad,
     _width = withWidth;
     _height = andHeight;
     _depth = 24;
+    _residentBytes = _width * _height * 3;
     _isLoaded = true;
   } else {
     glBindTexture(GL_TEXTURE_2D, _ident);
 	//log.trace(kModTexture, "Copying data...");
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, withWidth, andHeight,
-                    GL_BGR, GL_UNSIGNED_BYTE, dataToLoad);
+    uploader.texSubImage2D(0, 0, 0, withWidth, andHeight, GL_BGR,
+                           GL_UNSIGNED_BYTE, withWidth * andHeight * 3,
+                           dataToLoad);
 	//log.trace(kModTexture, "Done copying!");
   }
 }
 
+void Texture::loadVideoFrame(Video* fromVideo) {
+  if (EffectsManager::instance().hasVideoProgram()) {
+    DGPlanarFrame* frame = fromVideo->currentPlanes();
+    _loadPlanes(frame->planes, frame->width, frame->height);
+  } else {
+    DGFrame* frame = fromVideo->currentFrame();
+    this->loadRawData(frame->data, frame->width, frame->height);
+  }
+}
+
 void Texture::saveToFile(std::string fileName){
   // NOTE: Always saves in TGA format
   if (_isLoaded) {
@@ -530,12 +915,972 @@ void Texture::saveToFile(std::string fileName){
 }
 
 void Texture::unload() {
-  if (_isLoaded) {
-    glDeleteTextures(1, &_ident);
+  if (_isAtlased) {
+    TextureAtlas::instance().release(_ident);
+    memcpy(_texCoords, DefaultTexCoords, sizeof(_texCoords));
+    _isAtlased = false;
+    _residentBytes = 0;
+    _usageCount = 0;
+    _isLoaded = false;
+  } else if (_isLoaded) {
+    if (_cube) {
+      // The cube map goes along with its last face
+      _cube->faces &= ~(1 << _cubeFace);
+      if (!_cube->faces) {
+        glDeleteTextures(1, &_cube->ident);
+        _cube->ident = 0;
+        _cube->residentBytes = 0;
+      }
+    } else {
+      glDeleteTextures(1, &_ident);
+    }
+    if (_isPlanar) {
+      glDeleteTextures(2, _chromaIdents);
+      _chromaIdents[0] = 0;
+      _chromaIdents[1] = 0;
+      _isPlanar = false;
+    }
+    _residentBytes = 0;
     _usageCount = 0;
-    _isBitmapLoaded = false;
     _isLoaded = false;
   }
+  
+  if (SDL_LockMutex(_mutex) == 0) {
+    _unloadPreview();
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+  
+  // Discard any bitmap that was decoded but never uploaded
+  this->unloadBitmap();
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Private methods
+////////////////////////////////////////////////////////////
+
+int Texture::_bytesPerPixel() {
+  switch (_format) {
+    case GL_LUMINANCE: return 1;
+    case GL_LUMINANCE_ALPHA: return 2;
+    case GL_RGB: return 3;
+    case GL_RGBA: return 4;
+    default: return 0;
+  }
+}
+
+// Transcoded bitmaps are stored by the path, time and size of the source,
+// plus the engine build in case the encoder changes. Older entries are
+// simply left behind.
+std::string Texture::_cachePath() {
+  struct stat info;
+  if (stat(_resource.c_str(), &info) != 0)
+    return "";
+  
+  char stamp[64];
+  snprintf(stamp, sizeof(stamp), "|%lld|%lld|%d",
+           static_cast<long long>(info.st_mtime),
+           static_cast<long long>(info.st_size), DAGON_BUILD);
+  std::string key = _resource + stamp + DAGON_VERSION_STRING;
+  
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); i++) {
+    hash ^= static_cast<unsigned char>(key[i]);
+    hash *= 1099511628211ULL;
+  }
+  
+  char fileName[32];
+  snprintf(fileName, sizeof(fileName), "%016llx.ktx",
+           static_cast<unsigned long long>(hash));
+  return config.path(kPathUserData, std::string(kDefTexCachePath) + fileName,
+                     kObjectGeneric);
+}
+
+// Only compressed chains of a suitable size, at full quality
+bool Texture::_canTile() {
+  return _isTiled && _isMipmapped && config.texTopLevel <= 0 &&
+         _isBitmapCompressed && _levels > 1 &&
+         TextureCompressor::blockSize(_internalFormat) &&
+         _width > kTileBaseSize && _width % kTileSize == 0 &&
+         _height % kTileSize == 0;
+}
+
+// Must be called with the mutex locked from the thread owning the GL context,
+// and the cube map bound. Same levels as this face, without any data.
+void Texture::_allocateCube() {
+  bool hasLevels = _isBitmapMapped || (_isBitmapCompressed && _levels > 1);
+  int topLevel = hasLevels ? _topLevel() : 0;
+  int levels = hasLevels ? _levels - topLevel : 1;
+  GLenum type = _isBitmapMapped ? _type : GL_UNSIGNED_BYTE;
+  
+  _cube->firstFace = _cubeFace;
+  _cube->internalFormat = _internalFormat;
+  _cube->width = _width >> topLevel;
+  _cube->height = _height >> topLevel;
+  _cube->levels = levels;
+  for (int face = 0; face < 6; face++) {
+    if (face == _cubeFace)
+      continue;
+    
+    GLsizei width = _width >> topLevel, height = _height >> topLevel;
+    for (int i = 0; i < levels; i++) {
+      if (_isBitmapCompressed) {
+        GLsizei size = _bitmapSize;
+        if (_isBitmapMapped)
+          size = _levelSizes[topLevel + i];
+        else if (hasLevels)
+          size = static_cast<GLsizei>(
+            TextureCompressor::levelSize(_internalFormat, width, height));
+        glCompressedTexImage2D(CubeTargets[face], i, _internalFormat,
+                               width, height, 0, size, NULL);
+      } else {
+        glTexImage2D(CubeTargets[face], i, _internalFormat, width, height, 0,
+                     _format, type, NULL);
+      }
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+  }
+}
+
+// Must be called with the mutex locked from the thread owning the GL context,
+// and the cube map bound
+void Texture::_completeCube() {
+  if (_cube->needsMipmaps) {
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    _cube->needsMipmaps = false;
+  }
+  
+  // None of the previews are needed anymore, but detached faces keep theirs
+  // until loaded on their own
+  for (int i = 0; i < 6; i++) {
+    Texture* face = _cube->arrayOfFaces[i];
+    if (_cube->detachedFaces & (1 << i)) {
+      continue;
+    } else if (face == this) {
+      _unloadPreview();
+    } else if (SDL_LockMutex(face->_mutex) == 0) {
+      face->_unloadPreview();
+      SDL_UnlockMutex(face->_mutex);
+    } else {
+      log.error(kModTexture, "%s", kString18002);
+    }
+  }
+}
+
+// Must be called with the mutex locked. Mirrors the slots from _allocateCube().
+bool Texture::_fitsCube() {
+  bool hasLevels = _isBitmapMapped || (_isBitmapCompressed && _levels > 1);
+  int topLevel = hasLevels ? _topLevel() : 0;
+  int levels = hasLevels ? _levels - topLevel : 1;
+  return _internalFormat == _cube->internalFormat &&
+         (_width >> topLevel) == _cube->width &&
+         (_height >> topLevel) == _cube->height && levels == _cube->levels;
+}
+
+// Must be called with the mutex locked. No GL calls allowed here.
+void Texture::_decodeBitmap() {
+  if (!_hasResource) {
+    log.error(kModTexture, "%s: %s", kString10005, this->name().c_str());
+    return;
+  }
+  
+  FILE* fh = fopen(_resource.c_str(), "rb");
+  if (fh != NULL) {
+    char magic[12]; // Used to identity file types
+    if (fread(&magic, sizeof(magic), 1, fh) == 0) {
+      // Couldn't read magic number
+      log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
+    }
+    
+    if (TextureBundle::isBundle(magic, sizeof(magic))) {
+      // Handle our own TEX format
+      TextureBundle bundle;
+      if (bundle.open(_resource)) {
+        _decodeBitmap(bundle);
+      } else {
+        log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
+      }
+    } else if (memcmp(KTXIdent, &magic, sizeof(KTXIdent)) == 0) {
+      _decodeKTX(_resource);
+    } else if (_isMipmapped && _compressionLevel) {
+      // Node textures are compressed once, then read back from the cache
+      std::string cachePath = _cachePath();
+      struct stat info;
+      if (cachePath.empty() || stat(cachePath.c_str(), &info) != 0 ||
+          !_decodeKTX(cachePath)) {
+        _transcodeBitmap(fh);
+        if (_isBitmapLoaded && !cachePath.empty())
+          _saveToCache(cachePath);
+      }
+    } else { // Let stb_image load the texture
+      fseek(fh, 0, SEEK_SET);
+      int x, y, comp;
+      _bitmap = static_cast<GLubyte*>(stbi_load_from_file(fh, &x, &y,
+                                                          &comp,
+                                                          STBI_default));
+      if (_bitmap) {
+        _width = x;
+        _height = y;
+        _depth = comp;
+        _levels = 1;
+        _setFormats(comp);
+        _isBitmapLoaded = true;
+        _reduceBitmap();
+      } else {
+        // Nothing loaded
+        log.error(kModTexture, "%s: (%s) %s", kString10002,
+                  _resource.c_str(), stbi_failure_reason());
+      }
+    }
+    fclose(fh);
+  } else {
+    // File not found
+    log.error(kModTexture, "%s: %s", kString10001, _resource.c_str());
+  }
+}
+
+// Must be called with the mutex locked. No GL calls allowed here.
+void Texture::_decodeBitmap(TextureBundle& fromBundle) {
+  if (_indexInBundle >= fromBundle.numTextures()) {
+    log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
+    return;
+  }
+  
+  const TextureBundleEntry& entry = fromBundle.entry(_indexInBundle);
+  _width = static_cast<GLint>(fromBundle.width());
+  _height = static_cast<GLint>(fromBundle.height());
+  _levels = entry.levels;
+  
+  // We must be able to tell where each mipmap starts
+  if (_levels > 1 &&
+      TextureCompressor::chainSize(entry.format, _width, _height, _levels) !=
+      (entry.rawSize ? entry.rawSize : entry.size)) {
+    log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
+    return;
+  }
+  
+  _depth = static_cast<GLuint>(entry.depth);
+  _internalFormat = static_cast<GLint>(entry.format);
+  _format = GL_RGB; // Note that we only support RGB textures
+  _isBitmapCompressed = (fromBundle.compressionLevel() != 0);
+  
+  if (fromBundle.compressionLevel() == 2) {
+    // Keep the zlib stream around until it's inflated
+    _bitmapSize = static_cast<GLsizei>(entry.rawSize);
+    _deflatedSize = static_cast<GLsizei>(entry.size);
+    _deflatedBitmap = static_cast<GLubyte*>(malloc(_deflatedSize));
+    if (_deflatedBitmap && fromBundle.read(_indexInBundle, _deflatedBitmap)) {
+      _isBitmapDeflated = true;
+    } else {
+      free(_deflatedBitmap);
+      log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
+    }
+    return;
+  }
+  
+  // Get the bitmap
+  _bitmapSize = static_cast<GLsizei>(entry.size);
+  _bitmap = static_cast<GLubyte*>(malloc(_bitmapSize));
+  if (_bitmap && fromBundle.read(_indexInBundle, _bitmap)) {
+    _isBitmapLoaded = true;
+    if (!_isBitmapCompressed)
+      _reduceBitmap();
+  } else {
+    free(_bitmap);
+    log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
+  }
+}
+
+// Must be called with the mutex locked. No GL calls allowed here.
+bool Texture::_decodeKTX(const std::string& fromFile) {
+  // Map the whole file, so that levels go from the page cache to the driver
+  // without any intermediate copy
+#ifdef DAGON_WINDOWS
+  HANDLE file = CreateFileA(fromFile.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size)) {
+      HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+                                          NULL);
+      if (mapping) {
+        // The view remains valid after closing the handles
+        _mapping = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        _mappingSize = static_cast<size_t>(size.QuadPart);
+        CloseHandle(mapping);
+      }
+    }
+    CloseHandle(file);
+  }
+#else
+  int file = open(fromFile.c_str(), O_RDONLY);
+  if (file != -1) {
+    struct stat info;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+      _mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+      if (_mapping == MAP_FAILED)
+        _mapping = NULL;
+      else
+        _mappingSize = info.st_size;
+    }
+    close(file);
+  }
+#endif
+  
+  if (!_mapping) {
+    log.error(kModTexture, "%s: %s", kString10003, fromFile.c_str());
+    return false;
+  }
+  
+  const GLubyte* data = static_cast<const GLubyte*>(_mapping);
+  size_t position = sizeof(KTXIdent) + sizeof(KTXHeader);
+  bool isValid = (_mappingSize >= position);
+  
+  KTXHeader header;
+  bool isSwapped = false;
+  if (isValid) {
+    memcpy(&header, data + sizeof(KTXIdent), sizeof(header));
+    
+    if (header.endianness == kKTXEndiannessSwapped) {
+      uint32_t* field = reinterpret_cast<uint32_t*>(&header);
+      for (size_t i = 0; i < sizeof(header) / sizeof(uint32_t); i++)
+        field[i] = SwapKTX(field[i]);
+      isSwapped = true;
+    }
+    
+    // Only plain 2D textures. Swapped files must be byte-sized data.
+    isValid = header.endianness == kKTXEndianness &&
+              header.pixelWidth > 0 && header.pixelHeight > 0 &&
+              header.pixelDepth == 0 && header.numberOfArrayElements == 0 &&
+              header.numberOfFaces == 1 && header.numberOfMipmapLevels <= 32 &&
+              !(isSwapped && header.glTypeSize != 1);
+  }
+  
+  if (isValid) {
+    _width = static_cast<GLint>(header.pixelWidth);
+    _height = static_cast<GLint>(header.pixelHeight);
+    _levels = header.numberOfMipmapLevels ? header.numberOfMipmapLevels : 1;
+    _internalFormat = static_cast<GLint>(header.glInternalFormat);
+    _format = static_cast<GLenum>(header.glFormat);
+    _type = static_cast<GLenum>(header.glType);
+    _isBitmapCompressed = (header.glType == 0);
+    _depth = 24;
+    
+    position += header.bytesOfKeyValueData;
+    _levelOffsets.clear();
+    _levelSizes.clear();
+    
+    // Uncompressed levels are uploaded as they are, with rows padded to four
+    // bytes like the default unpack alignment, so their sizes must match.
+    // Compressed levels are stepped through by block for previews and tiles,
+    // so they must match too when we know the format. Other formats are
+    // never previewed nor tiled.
+    size_t pixelSize = 0;
+    bool hasBlocks = _isBitmapCompressed &&
+                     TextureCompressor::blockSize(_internalFormat);
+    if (!_isBitmapCompressed) {
+      pixelSize = PixelSizeKTX(_format, _type);
+      if (!pixelSize)
+        isValid = false;
+    }
+    
+    size_t width = header.pixelWidth, height = header.pixelHeight;
+    for (int i = 0; isValid && i < _levels; i++) {
+      if (position + sizeof(uint32_t) > _mappingSize) {
+        isValid = false;
+        break;
+      }
+      
+      uint32_t size;
+      memcpy(&size, data + position, sizeof(size));
+      if (isSwapped)
+        size = SwapKTX(size);
+      position += sizeof(uint32_t);
+      
+      if (size > _mappingSize - position) {
+        isValid = false;
+        break;
+      }
+      
+      if (pixelSize) {
+        size_t rowSize = (width * pixelSize + 3) & ~static_cast<size_t>(3);
+        if (size != rowSize * height) {
+          isValid = false;
+          break;
+        }
+      } else if (hasBlocks &&
+                 size != TextureCompressor::levelSize(_internalFormat,
+                                                      static_cast<int>(width),
+                                                      static_cast<int>(height))) {
+        isValid = false;
+        break;
+      }
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+      
+      _levelOffsets.push_back(static_cast<GLsizei>(position));
+      _levelSizes.push_back(static_cast<GLsizei>(size));
+      position += (size + 3) & ~3; // Levels are padded to four bytes
+    }
+  }
+  
+  if (isValid) {
+    _bitmap = static_cast<GLubyte*>(_mapping);
+    _bitmapSize = static_cast<GLsizei>(_mappingSize);
+    _isBitmapMapped = true;
+    _isBitmapLoaded = true;
+  } else {
+    log.error(kModTexture, "%s: %s", kString10003, fromFile.c_str());
+    _freeBitmap();
+  }
+  
+  return isValid;
+}
+
+// Must be called with the mutex locked
+void Texture::_freeBitmap() {
+  if (_mapping) {
+#ifdef DAGON_WINDOWS
+    UnmapViewOfFile(_mapping);
+#else
+    munmap(_mapping, _mappingSize);
+#endif
+    _mapping = NULL;
+    _mappingSize = 0;
+    _isBitmapMapped = false;
+  } else {
+    free(_bitmap);
+  }
+  
+  _bitmap = NULL;
+  _isBitmapLoaded = false;
+}
+
+// Must be called with the mutex locked. No GL calls allowed here.
+void Texture::_inflateBitmap() {
+  const char* input = reinterpret_cast<const char*>(_deflatedBitmap);
+  
+  if (_bitmapSize) {
+    // The size is known, so we inflate straight into the final buffer
+    _bitmap = static_cast<GLubyte*>(malloc(_bitmapSize));
+    if (_bitmap && stbi_zlib_decode_buffer(reinterpret_cast<char*>(_bitmap),
+                                           _bitmapSize, input,
+                                           _deflatedSize) == _bitmapSize) {
+      _isBitmapLoaded = true;
+    } else {
+      free(_bitmap);
+    }
+  } else {
+    // Old bundles don't store it
+    int size;
+    _bitmap = reinterpret_cast<GLubyte*>(stbi_zlib_decode_malloc(input,
+                                                                 _deflatedSize,
+                                                                 &size));
+    if (_bitmap) {
+      _bitmapSize = size;
+      _isBitmapLoaded = true;
+    }
+  }
+  
+  if (!_isBitmapLoaded)
+    log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
+  
+  free(_deflatedBitmap);
+  _isBitmapDeflated = false;
+}
+
+// Each plane goes to its own texture with a single channel, so a frame takes
+// 12 bits per pixel to upload instead of 24
+void Texture::_loadPlanes(unsigned char* const* planes, int width, int height) {
+  GLuint* idents[] = {&_ident, &_chromaIdents[0], &_chromaIdents[1]};
+  
+  for (int i = 0; i < 3; i++) {
+    int planeWidth = i ? width / 2 : width;
+    int planeHeight = i ? height / 2 : height;
+    GLsizei size = planeWidth * planeHeight;
+    if (!_isLoaded) {
+      glGenTextures(1, idents[i]);
+      glBindTexture(GL_TEXTURE_2D, *idents[i]);
+      uploader.texImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, planeWidth,
+                          planeHeight, GL_LUMINANCE, GL_UNSIGNED_BYTE,
+                          size, planes[i]);
+      // Linear filtering also interpolates chroma between samples
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+      glBindTexture(GL_TEXTURE_2D, *idents[i]);
+      uploader.texSubImage2D(0, 0, 0, planeWidth, planeHeight, GL_LUMINANCE,
+                             GL_UNSIGNED_BYTE, size, planes[i]);
+    }
+  }
+  
+  if (!_isLoaded) {
+    _width = width;
+    _height = height;
+    _depth = 12;
+    _residentBytes = _width * _height * 3 / 2;
+    _isPlanar = true;
+    _isLoaded = true;
+  }
+}
+
+// Leaves out the top levels of bitmaps without stored mipmaps. Must be
+// called with the mutex locked.
+void Texture::_reduceBitmap() {
+  int comp = _bytesPerPixel();
+  
+  for (int i = _topLevel(); i > 0 && comp; i--) {
+    int width = _width > 1 ? _width / 2 : 1;
+    int height = _height > 1 ? _height / 2 : 1;
+    GLubyte* reduced = static_cast<GLubyte*>(malloc(width * height * comp));
+    if (!reduced)
+      return;
+    
+    TextureCompressor::downsample(_bitmap, _width, _height, reduced, comp);
+    free(_bitmap);
+    _bitmap = reduced;
+    _bitmapSize = width * height * comp;
+    _width = width;
+    _height = height;
+  }
+}
+
+// Writes the compressed chain as a KTX file. Must be called with the mutex
+// locked. No GL calls allowed here.
+void Texture::_saveToCache(const std::string& toFile) {
+  std::string directory = config.path(kPathUserData, kDefTexCachePath,
+                                      kObjectGeneric);
+#ifdef DAGON_WINDOWS
+  CreateDirectoryA(directory.c_str(), NULL);
+#else
+  mkdir(directory.c_str(), 0755);
+#endif
+  
+  KTXHeader header;
+  header.endianness = kKTXEndianness;
+  header.glType = 0;
+  header.glTypeSize = 1;
+  header.glFormat = 0;
+  header.glInternalFormat = _internalFormat;
+  header.glBaseInternalFormat = _format;
+  header.pixelWidth = _width;
+  header.pixelHeight = _height;
+  header.pixelDepth = 0;
+  header.numberOfArrayElements = 0;
+  header.numberOfFaces = 1;
+  header.numberOfMipmapLevels = _levels;
+  header.bytesOfKeyValueData = 0;
+  
+  // Written aside and renamed, so a partial file is never picked up
+  std::string partialFile = toFile + ".part";
+  FILE* fh = fopen(partialFile.c_str(), "wb");
+  bool isWritten = (fh != NULL);
+  if (fh) {
+    isWritten = fwrite(KTXIdent, sizeof(KTXIdent), 1, fh) == 1 &&
+                fwrite(&header, sizeof(header), 1, fh) == 1;
+    
+    // Block sizes are multiples of four, so no padding is needed
+    const GLubyte* level = _bitmap;
+    int width = _width, height = _height;
+    for (int i = 0; isWritten && i < _levels; i++) {
+      uint32_t size = static_cast<uint32_t>(
+        TextureCompressor::levelSize(_internalFormat, width, height));
+      isWritten = fwrite(&size, sizeof(size), 1, fh) == 1 &&
+                  fwrite(level, size, 1, fh) == 1;
+      level += size;
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+    
+    if (fclose(fh) != 0)
+      isWritten = false;
+  }
+  
+  if (isWritten) {
+    remove(toFile.c_str());
+    isWritten = (rename(partialFile.c_str(), toFile.c_str()) == 0);
+  }
+  
+  if (!isWritten) {
+    remove(partialFile.c_str());
+    log.warning(kModTexture, "%s: %s", kString10009, toFile.c_str());
+  }
+}
+
+void Texture::_setFormats(int comp) {
+  _isBitmapCompressed = false;
+  _bitmapSize = _width * _height * comp;
+  
+  switch (comp) {
+    case STBI_grey: {
+      _format = GL_LUMINANCE;
+      if (_compressionLevel) {
+        _internalFormat = GL_COMPRESSED_LUMINANCE;
+      } else {
+        _internalFormat = GL_LUMINANCE;
+      }
+      break;
+    }
+    case STBI_grey_alpha: {
+      _format = GL_LUMINANCE_ALPHA;
+      if (_compressionLevel) {
+        _internalFormat = GL_COMPRESSED_LUMINANCE_ALPHA;
+      } else {
+        _internalFormat = GL_LUMINANCE_ALPHA;
+      }
+      break;
+    }
+    case STBI_rgb: {
+      _format = GL_RGB;
+      if (_compressionLevel) {
+        _internalFormat = GL_COMPRESSED_RGB;
+      } else {
+        _internalFormat = GL_RGB;
+      }
+      break;
+    }
+    case STBI_rgb_alpha: {
+      _format = GL_RGBA;
+      if (_compressionLevel) {
+        _internalFormat = GL_COMPRESSED_RGBA;
+      } else {
+        _internalFormat = GL_RGBA;
+      }
+      break;
+    }
+    default: {
+      _format = 0;
+      _internalFormat = 0;
+      log.warning(kModTexture, "%s: (%s) %d", kString10004,
+                  _resource.c_str(), comp);
+      break;
+    }
+  }
+}
+
+// Number of mipmaps left out of video memory
+int Texture::_topLevel() {
+  // Tiles take the place of the larger levels
+  if (_canTile()) {
+    int level = 0;
+    while ((_width >> level) > kTileBaseSize && level < _levels - 1)
+      level++;
+    return level;
+  }
+  
+  if (!_isMipmapped || config.texTopLevel <= 0)
+    return 0;
+  
+  int level = config.texTopLevel;
+  if (_levels > 1) {
+    if (level > _levels - 1)
+      level = _levels - 1;
+  } else if (_isBitmapCompressed || _isBitmapMapped) {
+    return 0; // Can't be scaled down
+  }
+  
+  while (level > 0 && ((_width >> level) == 0 || (_height >> level) == 0))
+    level--;
+  return level;
+}
+
+// Compresses the full mipmap chain on the CPU, so the driver doesn't have to
+// do it synchronously on upload. Must be called with the mutex locked. No GL
+// calls allowed here.
+void Texture::_transcodeBitmap(FILE* fromFile) {
+  fseek(fromFile, 0, SEEK_SET);
+  int x, y, comp;
+  GLubyte* pixels = static_cast<GLubyte*>(stbi_load_from_file(fromFile, &x, &y,
+                                                              &comp,
+                                                              STBI_rgb_alpha));
+  if (!pixels) {
+    log.error(kModTexture, "%s: (%s) %s", kString10002,
+              _resource.c_str(), stbi_failure_reason());
+    return;
+  }
+  
+  // Faces of a node share the format of their cube map, and panoramas are
+  // opaque anyway
+  bool hasAlpha = !_cube &&
+                  (comp == STBI_grey_alpha || comp == STBI_rgb_alpha);
+  int format = hasAlpha ? kTexFormatBC3 : kTexFormatBC1;
+  int levels = TextureCompressor::numLevels(x, y);
+  size_t size = TextureCompressor::chainSize(format, x, y, levels);
+  
+  _bitmap = static_cast<GLubyte*>(malloc(size));
+  if (!_bitmap) {
+    stbi_image_free(pixels);
+    log.error(kModTexture, "%s: %s", kString10002, _resource.c_str());
+    return;
+  }
+  
+  // Each level is reduced from the previous one before it's encoded
+  const GLubyte* level = pixels;
+  std::vector<GLubyte> current, reduced;
+  GLubyte* output = _bitmap;
+  int width = x, height = y;
+  for (int i = 0; i < levels; i++) {
+    TextureCompressor::compress(format, level, width, height, output,
+                                0, (height + 3) / 4);
+    output += TextureCompressor::levelSize(format, width, height);
+    
+    if (i + 1 < levels) {
+      reduced.resize((width > 1 ? width / 2 : 1) *
+                     (height > 1 ? height / 2 : 1) * 4);
+      TextureCompressor::downsample(level, width, height, &reduced[0]);
+      current.swap(reduced);
+      level = &current[0];
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+  }
+  stbi_image_free(pixels);
+  
+  _bitmapSize = static_cast<GLsizei>(size);
+  _width = x;
+  _height = y;
+  _depth = hasAlpha ? 32 : 24;
+  _levels = levels;
+  _format = hasAlpha ? GL_RGBA : GL_RGB;
+  _internalFormat = format;
+  _isBitmapCompressed = true;
+  _isBitmapLoaded = true;
+}
+
+// Must be called with the mutex locked from the thread owning the GL context
+void Texture::_uploadBitmap() {
+  Uint64 startTime = SDL_GetPerformanceCounter();
+  
+  if (_isAtlasable && _uploadToAtlas()) {
+    _freeBitmap();
+    _unloadPreview();
+    _uploadTime += SDL_GetPerformanceCounter() - startTime;
+    return;
+  }
+  
+  // Faces that don't fit the cube map, such as older cached ones, are drawn
+  // as plain textures from now on. They count as in for the rest.
+  if (_cube && _cube->faces && !_fitsCube()) {
+    _cube->detachedFaces |= (1 << _cubeFace);
+    if ((_cube->faces | _cube->detachedFaces) == kCubeComplete) {
+      glBindTexture(GL_TEXTURE_CUBE_MAP, _cube->ident);
+      _completeCube();
+    }
+    _cube = NULL;
+  }
+  
+  // Levels go to the target, parameters apply to the binding. Both are the
+  // same unless this is a face of a cube map.
+  GLenum target = GL_TEXTURE_2D;
+  GLenum binding = GL_TEXTURE_2D;
+  if (_cube) {
+    if (!_cube->ident)
+      glGenTextures(1, &_cube->ident);
+    _ident = _cube->ident;
+    target = CubeTargets[_cubeFace];
+    binding = GL_TEXTURE_CUBE_MAP;
+  } else {
+    glGenTextures(1, &_ident);
+  }
+  glBindTexture(binding, _ident);
+  
+  // Stored mipmaps above the configured top level are skipped
+  int topLevel = _topLevel();
+  bool isMipmapped = (_levels > 1);
+  bool isGenerated = false; // Mipmaps aren't stored
+  
+  if (_isBitmapMapped) {
+    // Each level is read by the driver straight from the file
+    GLsizei width = _width >> topLevel, height = _height >> topLevel;
+    _residentBytes = 0;
+    for (int i = topLevel; i < _levels; i++) {
+      const GLubyte* level = _bitmap + _levelOffsets[i];
+      if (_isBitmapCompressed) {
+        glCompressedTexImage2D(target, i - topLevel, _internalFormat,
+                               width, height, 0, _levelSizes[i], level);
+      } else {
+        glTexImage2D(target, i - topLevel, _internalFormat,
+                     width, height, 0, _format, _type, level);
+      }
+      _residentBytes += _levelSizes[i];
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+    glTexParameteri(binding, GL_TEXTURE_MAX_LEVEL, _levels - topLevel - 1);
+    _isLoaded = true;
+  } else if (_isBitmapCompressed && _levels > 1) {
+    // Prebuilt mipmaps, as produced by dagon-texpack
+    size_t skipped = TextureCompressor::chainSize(_internalFormat, _width,
+                                                  _height, topLevel);
+    GLubyte* level = _bitmap + skipped;
+    GLsizei width = _width >> topLevel, height = _height >> topLevel;
+    for (int i = topLevel; i < _levels; i++) {
+      GLsizei size = static_cast<GLsizei>(
+        TextureCompressor::levelSize(_internalFormat, width, height));
+      uploader.compressedTexImage2D(target, i - topLevel, _internalFormat,
+                                    width, height, size, level);
+      level += size;
+      width = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+    glTexParameteri(binding, GL_TEXTURE_MAX_LEVEL, _levels - topLevel - 1);
+    _residentBytes = _bitmapSize - static_cast<GLsizei>(skipped);
+    _isLoaded = true;
+  } else if (_isBitmapCompressed) {
+    GLint compressed;
+    uploader.compressedTexImage2D(target, 0, _internalFormat, _width, _height,
+                                  _bitmapSize, _bitmap);
+    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    if (compressed == GL_TRUE) {
+      _residentBytes = _bitmapSize;
+      _isLoaded = true;
+    } else {
+      log.error(kModTexture, "%s: %s", kString10003, _resource.c_str());
+    }
+  } else {
+    // Older drivers build the mipmaps as the bitmap is uploaded
+    bool hasGenerate = GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+    if (_isMipmapped && !hasGenerate)
+      glTexParameteri(binding, GL_GENERATE_MIPMAP, GL_TRUE);
+    
+    uploader.texImage2D(target, 0, _internalFormat, _width, _height, _format,
+                        GL_UNSIGNED_BYTE, _bitmapSize, _bitmap);
+    _residentBytes = _bitmapSize;
+    
+    // If we asked the driver to compress it, find out how much it takes now
+    if (_compressionLevel) {
+      GLint compressed, size;
+      glGetTexLevelParameteriv(target, 0, GL_TEXTURE_COMPRESSED, &compressed);
+      if (compressed == GL_TRUE) {
+        glGetTexLevelParameteriv(target, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE,
+                                 &size);
+        _residentBytes = size;
+      }
+    }
+    
+    if (_isMipmapped) {
+      // A cube map can't be completed until all faces are in
+      if (hasGenerate && _cube)
+        _cube->needsMipmaps = true;
+      else if (hasGenerate)
+        glGenerateMipmap(GL_TEXTURE_2D);
+      _residentBytes += _residentBytes / 3; // The whole chain
+      isMipmapped = true;
+      isGenerated = true;
+    }
+    _isLoaded = true;
+  }
+  
+  if (isMipmapped)
+    glTexParameteri(binding, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  else
+    glTexParameteri(binding, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(binding, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(binding, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(binding, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  if (_cube)
+    glTexParameteri(binding, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  
+  if (_cube) {
+    // Faces not in yet are drawn with their previews, if any. Generated
+    // mipmaps are only sampled once all of them are.
+    if (_isLoaded) {
+      if (!_cube->faces) {
+        _allocateCube();
+        _cube->residentBytes = _residentBytes * 6;
+      }
+      _cube->faces |= (1 << _cubeFace);
+      if ((_cube->faces | _cube->detachedFaces) == kCubeComplete)
+        _completeCube();
+      else if (isGenerated)
+        glTexParameteri(binding, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    }
+  } else {
+    // The preview isn't needed anymore
+    _unloadPreview();
+  }
+  
+  // Tiles are copied from the bitmap later on
+  if (!_canTile())
+    _freeBitmap();
+  
+  _uploadTime += SDL_GetPerformanceCounter() - startTime;
+}
+
+// Must be called with the mutex locked from the thread owning the GL context
+void Texture::_unloadPreview() {
+  if (_hasPreview) {
+    glDeleteTextures(1, &_previewIdent);
+    _hasPreview = false;
+  }
+  
+  if (_isPreviewLoaded) {
+    free(_previewBitmap);
+    _isPreviewLoaded = false;
+  }
+}
+
+// Must be called with the mutex locked from the thread owning the GL context
+bool Texture::_uploadToAtlas() {
+  if (_isBitmapCompressed || _isBitmapMapped || _levels > 1 ||
+      _width > kMaxAtlasedSize || _height > kMaxAtlasedSize)
+    return false;
+  
+  int comp = _bytesPerPixel();
+  if (!comp)
+    return false;
+  
+  // Edges are repeated around the region so that filtering never samples
+  // the neighbours
+  int paddedWidth = _width + 2;
+  int paddedHeight = _height + 2;
+  GLubyte* padded = static_cast<GLubyte*>(malloc(paddedWidth * paddedHeight *
+                                                 comp));
+  if (!padded)
+    return false;
+  
+  for (int y = 0; y < paddedHeight; y++) {
+    int fromY = y == 0 ? 0 : (y > _height ? _height - 1 : y - 1);
+    for (int x = 0; x < paddedWidth; x++) {
+      int fromX = x == 0 ? 0 : (x > _width ? _width - 1 : x - 1);
+      memcpy(padded + (y * paddedWidth + x) * comp,
+             _bitmap + (fromY * _width + fromX) * comp, comp);
+    }
+  }
+  
+  GLuint page;
+  int x, y;
+  if (!TextureAtlas::instance().place(paddedWidth, paddedHeight, page, x, y)) {
+    free(padded);
+    return false;
+  }
+  
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, paddedWidth, paddedHeight,
+                  _format, GL_UNSIGNED_BYTE, padded);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  free(padded);
+  
+  GLfloat left = static_cast<GLfloat>(x + 1) / kAtlasPageSize;
+  GLfloat top = static_cast<GLfloat>(y + 1) / kAtlasPageSize;
+  GLfloat right = static_cast<GLfloat>(x + 1 + _width) / kAtlasPageSize;
+  GLfloat bottom = static_cast<GLfloat>(y + 1 + _height) / kAtlasPageSize;
+  GLfloat texCoords[] = {left, top, right, top, right, bottom, left, bottom};
+  memcpy(_texCoords, texCoords, sizeof(_texCoords));
+  
+  _ident = page;
+  _residentBytes = _width * _height * 4;
+  _isAtlased = true;
+  _isLoaded = true;
+  
+  return true;
 }
   
 }
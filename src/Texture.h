@@ -18,7 +18,9 @@
 // Headers
 ////////////////////////////////////////////////////////////
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include <GL/glew.h>
 #include <SDL2/SDL_mutex.h>
@@ -31,31 +33,50 @@ namespace dagon {
 // Definitions
 ////////////////////////////////////////////////////////////
 
-// TODO: We should convert all short vars to int for better speed here,
-// also read new defines.
+// Previews are drawn at a quarter of the resolution until the full texture
+// is ready. Stored mipmaps are used when available.
+#define kTexturePreviewLevel 2
 
-typedef struct {
-  char name[80];
-  short width;
-  short height;
-  short compressionLevel; // 0: None, 1: GL only, 2: GL & zlib
-  short numTextures;
-} TEXMainHeader;
-
-typedef struct {
-  short cubePosition;
-  short depth;
-  int size;
-  int format;
-} TEXSubHeader;
+// All six faces of a cube map have been uploaded
+#define kCubeComplete 0x3F
 
 class Config;
 class Log;
+class Texture;
+class TextureBundle;
+class TextureUploader;
+class Video;
+
+// The faces of a node share a single cube map, so the panorama is drawn in
+// one call and filtered across the edges. Each face uploads to its own slot
+// and marks its bit. The first one allocates the other slots empty, so the
+// faces marked so far can be drawn before the rest are in. The cube is
+// deleted along with the last face, so the faces are resident as one. Faces
+// that don't match the slots are detached, and drawn on their own.
+typedef struct {
+  GLuint ident;
+  int faces;
+  int detachedFaces;
+  int firstFace; // Allocated the slots, after the format of its own
+  GLint internalFormat;
+  GLsizei width;
+  GLsizei height;
+  int levels;
+  size_t residentBytes; // All six slots, from the first face uploaded
+  bool needsMipmaps; // Built once all faces are in
+  Texture* arrayOfFaces[6];
+} TextureCube;
 
 ////////////////////////////////////////////////////////////
 // Interface
 ////////////////////////////////////////////////////////////
 
+// Threading: GL objects are confined to the thread owning the context. Only
+// that thread creates, binds and deletes them, and only that thread changes
+// the identifiers and the loaded state, so binding needs no lock. The mutex
+// guards the bitmaps, which workers decode in the background. Methods that
+// say nothing about GL are safe to call from any thread.
+
 class Texture : public Object {
  public:
   Texture();
@@ -63,50 +84,148 @@ class Texture : public Object {
   ~Texture();
   
   // Checks
+  bool hasPreview();
   bool hasResource();
+  bool hasTiles(); // Loaded, with the bitmap kept to copy tiles from
+  bool isAtlased();
   bool isLoaded();
   bool isBitmapLoaded();
+  bool isBitmapDeflated();
+  bool isPreviewLoaded();
+  bool isPlanar(); // Holds a video frame to be drawn with beginVideo()
   
   // Gets
+  double decodeTime(); // In milliseconds, since the texture was created
   int depth();
+  TextureCube* cube(); // NULL unless the texture is a face of a node
+  int cubeFace(); // Slot in the cube map, same as its bit
+  int evictionCount();
   int indexInBundle();
   int height();
+  GLuint ident(); // Zero until loaded, shared by atlased textures
+  GLint internalFormat();
+  unsigned int lastUsedFrame();
+  size_t residentBytes();
   std::string resource();
+  // Texture coordinates of the slide, which cover a region of the page when
+  // the texture is atlased
+  float* texCoords();
+  double uploadTime(); // Same as above
   unsigned int usageCount();
   int width();
   
   // Sets
+  void increaseEvictionCount();
   void increaseUsageCount();
+  // Recently used textures are the last ones to be evicted. Bound textures
+  // are marked on their own.
+  void markUsed();
+  // Small bitmaps will be placed in a shared atlas page when uploaded
+  void setAtlasable(bool flag);
+  // Uploads the bitmap to the given face of a cube map instead
+  void setCube(TextureCube* cube, int face);
   void setIndexInBundle(int index);
+  // Mipmaps are built when missing and filtered trilinearly. The top levels
+  // may be left out, as configured.
+  void setMipmapped(bool flag);
   void setResource(std::string fromFileName);
+  // Faces large enough are uploaded at a lower resolution and drawn with
+  // full resolution tiles on top, see TextureTiles
+  void setTiled(bool flag);
   
   // State changes
   void bind();
   void clear();
+  // Copies a tile of the largest level, in the same block format. Only valid
+  // while hasTiles() is true.
+  bool copyTile(int column, int row, GLubyte* output);
+  // Decompresses a bitmap read from a bundle with compression level 2
+  void inflateBitmap();
+  // Returns right away, without locking, once loaded. A resource that fails
+  // to load isn't tried again until it's set anew.
   void load();
-  void loadBitmap(); // Temporary to test preloader
+  // Decodes the resource to client memory without touching GL, so it's safe
+  // to call from any thread. A later load() only has to upload the bitmap.
+  void loadBitmap();
+  // Same as above, reading from a bundle that is already open. Used to decode
+  // all the faces of a node in a single pass. Payloads compressed with zlib
+  // are left deflated so that inflateBitmap() can run on another thread.
+  void loadBitmap(TextureBundle& fromBundle);
   void unloadBitmap();
+  // Reads only the size from the header of the resource. Returns false if
+  // the format can't be probed, in which case the bitmap must be decoded.
+  bool probe();
+  // Builds a low resolution copy from the decoded bitmap, again without GL
+  void loadPreview();
+  // Reads just the small mipmaps of a bundle, before the whole bitmap
+  void loadPreview(TextureBundle& fromBundle);
+  // Makes the preview drawable. Bound instead until the texture is loaded.
+  void uploadPreview();
   
   // Textures loaded from memory are not managed
   void loadFromMemory(const unsigned char* dataToLoad, long size);
   void loadRawData(const unsigned char* dataToLoad,
                    int withWidth, int andHeight);
+  // Uploads the current frame of a video. The planes are uploaded as they
+  // were decoded and converted by the shader, unless shaders aren't
+  // available, in which case the frame is converted here.
+  void loadVideoFrame(Video* fromVideo);
   void saveToFile(std::string fileName);
   void unload();
   
  private:
   Config& config;
   Log& log;
+  TextureUploader& uploader;
   
   GLubyte* _bitmap;
+  GLsizei _bitmapSize;
+  GLubyte* _deflatedBitmap;
+  GLsizei _deflatedSize;
   unsigned int _compressionLevel;
+  TextureCube* _cube;
+  int _cubeFace;
+  Uint64 _decodeTime;
   GLint _depth;
+  int _evictionCount;
+  std::atomic<bool> _hasFailed; // Checked without the lock by load()
   bool _hasResource;
+  GLenum _format;
+  bool _isAtlasable;
+  bool _isAtlased;
   GLint _height;
   GLuint _ident;
+  GLuint _chromaIdents[2]; // U and V planes, the luma goes in _ident
   int _indexInBundle;
+  GLint _internalFormat;
+  bool _isBitmapCompressed;
+  bool _isBitmapDeflated;
   bool _isBitmapLoaded;
-  bool _isLoaded;
+  bool _isBitmapMapped; // Points straight into a mapped KTX file
+  std::atomic<bool> _isLoaded; // Also checked by workers
+  bool _isMipmapped;
+  bool _isPlanar;
+  bool _isTiled;
+  unsigned int _lastUsedFrame;
+  int _levels; // Mipmaps stored in the bitmap, largest first
+  GLubyte* _previewBitmap;
+  GLsizei _previewSize;
+  GLint _previewFormat;
+  GLint _previewHeight;
+  GLuint _previewIdent;
+  int _previewLevels;
+  GLint _previewWidth;
+  bool _hasPreview;
+  bool _isPreviewCompressed;
+  bool _isPreviewLoaded;
+  std::vector<GLsizei> _levelOffsets; // Only for mapped files
+  std::vector<GLsizei> _levelSizes;
+  void* _mapping;
+  size_t _mappingSize;
+  size_t _residentBytes; // Actual size in video memory
+  GLfloat _texCoords[8];
+  GLenum _type; // Only for mapped files
+  Uint64 _uploadTime;
   unsigned int _usageCount; // Used to keep track of the most used textures
   GLint _width;
   
@@ -114,6 +233,27 @@ class Texture : public Object {
   // Eventually all file management will be handled by a ResourceManager object
   std::string _resource;
   
+  int _bytesPerPixel();
+  std::string _cachePath();
+  void _allocateCube();
+  bool _canTile();
+  void _completeCube();
+  void _decodeBitmap();
+  void _decodeBitmap(TextureBundle& fromBundle);
+  bool _decodeKTX(const std::string& fromFile);
+  bool _fitsCube(); // Same format, size and levels as the slots
+  void _freeBitmap();
+  void _inflateBitmap();
+  void _loadPlanes(unsigned char* const* planes, int width, int height);
+  void _reduceBitmap();
+  void _saveToCache(const std::string& toFile);
+  void _setFormats(int comp);
+  int _topLevel();
+  void _transcodeBitmap(FILE* fromFile);
+  void _unloadPreview();
+  void _uploadBitmap();
+  bool _uploadToAtlas();
+  
   Texture(const Texture&);
   void operator=(const Texture&);
 };
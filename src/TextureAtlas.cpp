@@ -0,0 +1,171 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include "TextureAtlas.h"
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Implementation - Gets
+////////////////////////////////////////////////////////////
+
+int TextureAtlas::numPages() {
+  return static_cast<int>(_arrayOfPages.size());
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - State changes
+////////////////////////////////////////////////////////////
+
+bool TextureAtlas::place(int width, int height, GLuint& page,
+                         int& x, int& y) {
+  if (width > kAtlasPageSize || height > kAtlasPageSize)
+    return false;
+
+  std::vector<AtlasPage>::iterator it = _arrayOfPages.begin();
+  while (it != _arrayOfPages.end()) {
+    if (_fit(*it, width, height, x, y))
+      break;
+    ++it;
+  }
+
+  if (it == _arrayOfPages.end()) {
+    AtlasPage newPage;
+    AtlasSegment floor = {0, 0, kAtlasPageSize};
+    newPage.skyline.push_back(floor);
+    newPage.regions = 0;
+
+    glGenTextures(1, &newPage.ident);
+    glBindTexture(GL_TEXTURE_2D, newPage.ident);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, kAtlasPageSize, kAtlasPageSize,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    _arrayOfPages.push_back(newPage);
+    it = _arrayOfPages.end() - 1;
+    if (!_fit(*it, width, height, x, y))
+      return false;
+  }
+
+  _insert(*it, x, y, width, height);
+  it->regions++;
+  page = it->ident;
+  glBindTexture(GL_TEXTURE_2D, page);
+
+  return true;
+}
+
+void TextureAtlas::release(GLuint page) {
+  std::vector<AtlasPage>::iterator it = _arrayOfPages.begin();
+  while (it != _arrayOfPages.end()) {
+    if (it->ident == page) {
+      if (--it->regions == 0) {
+        glDeleteTextures(1, &it->ident);
+        _arrayOfPages.erase(it);
+      }
+      return;
+    }
+    ++it;
+  }
+}
+
+void TextureAtlas::terminate() {
+  std::vector<AtlasPage>::iterator it = _arrayOfPages.begin();
+  while (it != _arrayOfPages.end()) {
+    glDeleteTextures(1, &it->ident);
+    ++it;
+  }
+  _arrayOfPages.clear();
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Private methods
+////////////////////////////////////////////////////////////
+
+// Finds the lowest spot where the region rests on the skyline
+bool TextureAtlas::_fit(AtlasPage& page, int width, int height,
+                        int& x, int& y) {
+  int bestTop = kAtlasPageSize + 1;
+  int bestX = 0, bestY = 0;
+
+  for (size_t i = 0; i < page.skyline.size(); i++) {
+    int left = page.skyline[i].x;
+    if (left + width > kAtlasPageSize)
+      break;
+
+    // The region sits on the highest segment it spans
+    int top = 0;
+    int covered = 0;
+    for (size_t j = i; covered < width; j++) {
+      if (page.skyline[j].y > top)
+        top = page.skyline[j].y;
+      covered += page.skyline[j].width;
+    }
+
+    if (top + height <= kAtlasPageSize && top + height < bestTop) {
+      bestTop = top + height;
+      bestX = left;
+      bestY = top;
+    }
+  }
+
+  if (bestTop > kAtlasPageSize)
+    return false;
+
+  x = bestX;
+  y = bestY;
+  return true;
+}
+
+void TextureAtlas::_insert(AtlasPage& page, int x, int y,
+                           int width, int height) {
+  AtlasSegment segment = {x, y + height, width};
+
+  std::vector<AtlasSegment>::iterator it = page.skyline.begin();
+  while (it->x != x)
+    ++it;
+  it = page.skyline.insert(it, segment);
+
+  // Trim the segments now covered by the new one
+  std::vector<AtlasSegment>::iterator next = it + 1;
+  while (next != page.skyline.end() && next->x < x + width) {
+    int overlap = x + width - next->x;
+    if (overlap >= next->width) {
+      next = page.skyline.erase(next);
+    } else {
+      next->x += overlap;
+      next->width -= overlap;
+      break;
+    }
+  }
+
+  // Merge neighbours at the same height
+  it = page.skyline.begin();
+  while (it + 1 != page.skyline.end()) {
+    if (it->y == (it + 1)->y) {
+      it->width += (it + 1)->width;
+      page.skyline.erase(it + 1);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}
@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+#ifndef DAGON_TEXTUREATLAS_H_
+#define DAGON_TEXTUREATLAS_H_
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <GL/glew.h>
+
+#include <vector>
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+// Each page is an RGBA texture of this size, 4 MB of video memory
+#define kAtlasPageSize 1024
+
+// Larger bitmaps keep a texture of their own
+#define kMaxAtlasedSize 256
+
+// Segment of the skyline, the top of what's been placed so far
+typedef struct {
+  int x;
+  int y;
+  int width;
+} AtlasSegment;
+
+typedef struct {
+  GLuint ident;
+  std::vector<AtlasSegment> skyline;
+  int regions; // Released along with the last one
+} AtlasPage;
+
+////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////
+
+// Small bitmaps of overlays, buttons and cursors share a few pages, so that
+// drawing the interface needs a handful of binds regardless of the number of
+// icons. Regions are placed bottom-left on a skyline. Space isn't reclaimed
+// until every region of a page has been released. Only to be used from the
+// thread owning the GL context.
+
+class TextureAtlas {
+  std::vector<AtlasPage> _arrayOfPages;
+
+  bool _fit(AtlasPage& page, int width, int height, int& x, int& y);
+  void _insert(AtlasPage& page, int x, int y, int width, int height);
+
+  TextureAtlas() {}
+  TextureAtlas(const TextureAtlas&);
+  void operator=(const TextureAtlas&);
+  ~TextureAtlas() {}
+
+public:
+  static TextureAtlas& instance() {
+    static TextureAtlas textureAtlas;
+    return textureAtlas;
+  }
+
+  // Gets
+  int numPages();
+
+  // State changes
+  // Reserves a region, returning the page and its position. The region is
+  // left bound so it can be filled with glTexSubImage2D.
+  bool place(int width, int height, GLuint& page, int& x, int& y);
+  void release(GLuint page);
+  void terminate();
+};
+
+}
+
+#endif // DAGON_TEXTUREATLAS_H_
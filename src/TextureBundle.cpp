@@ -0,0 +1,376 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "TextureBundle.h"
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+const char TEX1Ident[] = "KS_TEX"; // Compared with the terminator
+const char TEX2Ident[] = "KS_TEX2";
+
+static uint32_t ReadLE32(const unsigned char* buffer) {
+  return static_cast<uint32_t>(buffer[0]) |
+         (static_cast<uint32_t>(buffer[1]) << 8) |
+         (static_cast<uint32_t>(buffer[2]) << 16) |
+         (static_cast<uint32_t>(buffer[3]) << 24);
+}
+
+static uint64_t ReadLE64(const unsigned char* buffer) {
+  return static_cast<uint64_t>(ReadLE32(buffer)) |
+         (static_cast<uint64_t>(ReadLE32(buffer + 4)) << 32);
+}
+
+static void WriteLE32(unsigned char* buffer, uint32_t value) {
+  buffer[0] = value & 0xFF;
+  buffer[1] = (value >> 8) & 0xFF;
+  buffer[2] = (value >> 16) & 0xFF;
+  buffer[3] = (value >> 24) & 0xFF;
+}
+
+static void WriteLE64(unsigned char* buffer, uint64_t value) {
+  WriteLE32(buffer, static_cast<uint32_t>(value));
+  WriteLE32(buffer + 4, static_cast<uint32_t>(value >> 32));
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Constructor
+////////////////////////////////////////////////////////////
+
+TextureBundle::TextureBundle() {
+  _compressionLevel = 0;
+  _fileSize = 0;
+  _handle = NULL;
+  _height = 0;
+  _position = 0;
+  _version = 0;
+  _width = 0;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Destructor
+////////////////////////////////////////////////////////////
+
+TextureBundle::~TextureBundle() {
+  this->close();
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Checks
+////////////////////////////////////////////////////////////
+
+bool TextureBundle::isBundle(const char* magic, size_t length) {
+  if (length >= sizeof(TEX2Ident) &&
+      memcmp(TEX2Ident, magic, sizeof(TEX2Ident)) == 0)
+    return true;
+
+  if (length >= sizeof(TEX1Ident) &&
+      memcmp(TEX1Ident, magic, sizeof(TEX1Ident)) == 0)
+    return true;
+
+  return false;
+}
+
+bool TextureBundle::isOpen() {
+  return _handle != NULL;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Gets
+////////////////////////////////////////////////////////////
+
+int TextureBundle::compressionLevel() {
+  return _compressionLevel;
+}
+
+const TextureBundleEntry& TextureBundle::entry(int index) {
+  return _arrayOfEntries.at(index);
+}
+
+int TextureBundle::height() {
+  return _height;
+}
+
+int TextureBundle::numTextures() {
+  return static_cast<int>(_arrayOfEntries.size());
+}
+
+int TextureBundle::version() {
+  return _version;
+}
+
+int TextureBundle::width() {
+  return _width;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - State changes
+////////////////////////////////////////////////////////////
+
+void TextureBundle::close() {
+  if (_handle) {
+    fclose(_handle);
+    _handle = NULL;
+  }
+
+  _arrayOfEntries.clear();
+  _version = 0;
+}
+
+bool TextureBundle::open(const std::string& fromFileName) {
+  this->close();
+
+  _handle = fopen(fromFileName.c_str(), "rb");
+  if (!_handle)
+    return false;
+
+  // Tables are checked against the size of the file
+  char magic[8];
+  if (_measure() &&
+      fread(magic, 1, sizeof(magic), _handle) == sizeof(magic)) {
+    _position = sizeof(magic);
+
+    if (memcmp(TEX2Ident, magic, sizeof(TEX2Ident)) == 0) {
+      if (_openVersion2())
+        return true;
+    } else if (memcmp(TEX1Ident, magic, sizeof(TEX1Ident)) == 0) {
+      if (_openVersion1())
+        return true;
+    }
+  }
+
+  this->close();
+  return false;
+}
+
+bool TextureBundle::read(int index, void* intoBuffer) {
+  if (!_handle || index < 0 || index >= this->numTextures())
+    return false;
+
+  return this->read(index, 0, _arrayOfEntries[index].size, intoBuffer);
+}
+
+bool TextureBundle::read(int index, uint64_t offset, uint64_t size,
+                         void* intoBuffer) {
+  if (!_handle || index < 0 || index >= this->numTextures())
+    return false;
+
+  const TextureBundleEntry& entry = _arrayOfEntries[index];
+  if (offset > entry.size || size > entry.size - offset ||
+      !_seek(entry.offset + offset))
+    return false;
+
+  size_t length = static_cast<size_t>(size);
+  if (fread(intoBuffer, 1, length, _handle) != length) {
+    // Position is unknown now, so force a seek on the next read
+    _position = ~static_cast<uint64_t>(0);
+    return false;
+  }
+
+  _position += size;
+  return true;
+}
+
+bool TextureBundle::write(const std::string& toFileName, int width, int height,
+                          int compressionLevel,
+                          const std::vector<TextureBundleEntry>& arrayOfEntries,
+                          const std::vector<const void*>& arrayOfPayloads) {
+  if (arrayOfEntries.size() != arrayOfPayloads.size())
+    return false;
+
+  FILE* fh = fopen(toFileName.c_str(), "wb");
+  if (!fh)
+    return false;
+
+  size_t numTextures = arrayOfEntries.size();
+  std::vector<unsigned char> header(kTEX2HeaderSize +
+                                    kTEX2EntrySize * numTextures);
+
+  memcpy(&header[0], TEX2Ident, sizeof(TEX2Ident));
+  WriteLE32(&header[8], width);
+  WriteLE32(&header[12], height);
+  WriteLE32(&header[16], compressionLevel);
+  WriteLE32(&header[20], static_cast<uint32_t>(numTextures));
+
+  // Payloads are laid out right after the table, in order
+  uint64_t offset = header.size();
+  for (size_t i = 0; i < numTextures; i++) {
+    const TextureBundleEntry& entry = arrayOfEntries[i];
+    unsigned char* data = &header[kTEX2HeaderSize + kTEX2EntrySize * i];
+    WriteLE32(data, entry.cubePosition);
+    WriteLE32(data + 4, entry.depth);
+    WriteLE32(data + 8, entry.format);
+    WriteLE32(data + 12, entry.levels);
+    WriteLE64(data + 16, offset);
+    WriteLE64(data + 24, entry.size);
+    WriteLE64(data + 32, entry.rawSize);
+    offset += entry.size;
+  }
+
+  bool success = fwrite(&header[0], 1, header.size(), fh) == header.size();
+  for (size_t i = 0; success && i < numTextures; i++) {
+    size_t size = static_cast<size_t>(arrayOfEntries[i].size);
+    success = fwrite(arrayOfPayloads[i], 1, size, fh) == size;
+  }
+
+  if (fclose(fh) != 0)
+    success = false;
+
+  return success;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Private methods
+////////////////////////////////////////////////////////////
+
+bool TextureBundle::_measure() {
+#if defined(_MSC_VER)
+  if (_fseeki64(_handle, 0, SEEK_END) != 0)
+    return false;
+  __int64 size = _ftelli64(_handle);
+#elif defined(_WIN32)
+  if (fseeko64(_handle, 0, SEEK_END) != 0)
+    return false;
+  off64_t size = ftello64(_handle);
+#else
+  if (fseeko(_handle, 0, SEEK_END) != 0)
+    return false;
+  off_t size = ftello(_handle);
+#endif
+
+  if (size < 0)
+    return false;
+
+  _fileSize = static_cast<uint64_t>(size);
+  rewind(_handle);
+  return true;
+}
+
+bool TextureBundle::_openVersion1() {
+  // Legacy bundles have no table, so we walk the subheaders once. Note these
+  // are native-endian dumps of the structs.
+  TEXMainHeader header;
+  if (fread(&header, 1, sizeof(header), _handle) != sizeof(header))
+    return false;
+
+  _version = 1;
+  _width = header.width;
+  _height = header.height;
+  _compressionLevel = header.compressionLevel;
+  _position += sizeof(header);
+
+  for (int i = 0; i < header.numTextures; i++) {
+    TEXSubHeader subheader;
+    if (fread(&subheader, 1, sizeof(subheader), _handle) != sizeof(subheader))
+      break; // Some old bundles may carry a wrong count
+    _position += sizeof(subheader);
+    if (subheader.size < 0 ||
+        static_cast<uint64_t>(subheader.size) > _fileSize - _position)
+      break; // Truncated
+
+    TextureBundleEntry entry;
+    entry.cubePosition = subheader.cubePosition;
+    entry.depth = subheader.depth;
+    entry.format = subheader.format;
+    entry.levels = 1;
+    entry.offset = _position;
+    entry.size = subheader.size;
+    if (_compressionLevel == 2)
+      entry.rawSize = 0;
+    else
+      entry.rawSize = subheader.size;
+    _arrayOfEntries.push_back(entry);
+
+    if (!_seek(_position + subheader.size))
+      break;
+  }
+
+  return !_arrayOfEntries.empty();
+}
+
+bool TextureBundle::_openVersion2() {
+  unsigned char header[kTEX2HeaderSize - 8];
+  if (fread(header, 1, sizeof(header), _handle) != sizeof(header))
+    return false;
+
+  _version = 2;
+  _width = ReadLE32(header);
+  _height = ReadLE32(header + 4);
+  _compressionLevel = ReadLE32(header + 8);
+  uint32_t numTextures = ReadLE32(header + 12);
+  _position += sizeof(header);
+
+  // The whole table is read at once, so it must fit in the file first
+  if (_width <= 0 || _height <= 0 || numTextures == 0 ||
+      numTextures > (_fileSize - _position) / kTEX2EntrySize)
+    return false;
+  std::vector<unsigned char> table(static_cast<size_t>(kTEX2EntrySize) *
+                                   numTextures);
+  if (fread(&table[0], 1, table.size(), _handle) != table.size())
+    return false;
+  _position += table.size();
+
+  uint64_t maxRawSize = static_cast<uint64_t>(_width) * _height *
+                        kTEX2MaxRawBytesPerPixel;
+
+  for (uint32_t i = 0; i < numTextures; i++) {
+    const unsigned char* data = &table[kTEX2EntrySize * i];
+    TextureBundleEntry entry;
+    entry.cubePosition = ReadLE32(data);
+    entry.depth = ReadLE32(data + 4);
+    entry.format = ReadLE32(data + 8);
+    entry.levels = ReadLE32(data + 12);
+    entry.offset = ReadLE64(data + 16);
+    entry.size = ReadLE64(data + 24);
+    entry.rawSize = ReadLE64(data + 32);
+
+    // Payloads must lie within the file, and inflate to a sensible size
+    if (entry.levels < 1 || entry.levels > kTEX2MaxLevels ||
+        entry.offset > _fileSize || entry.size > _fileSize - entry.offset ||
+        entry.rawSize > maxRawSize)
+      return false;
+    _arrayOfEntries.push_back(entry);
+  }
+
+  return true;
+}
+
+bool TextureBundle::_seek(uint64_t offset) {
+  if (offset == _position)
+    return true;
+
+#if defined(_MSC_VER)
+  int result = _fseeki64(_handle, static_cast<__int64>(offset), SEEK_SET);
+#elif defined(_WIN32)
+  int result = fseeko64(_handle, static_cast<off64_t>(offset), SEEK_SET);
+#else
+  int result = fseeko(_handle, static_cast<off_t>(offset), SEEK_SET);
+#endif
+
+  if (result != 0)
+    return false;
+
+  _position = offset;
+  return true;
+}
+
+}
@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+#ifndef DAGON_TEXTUREBUNDLE_H_
+#define DAGON_TEXTUREBUNDLE_H_
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+// Version 2 of the TEX format. All values are little-endian.
+//
+//   Offset  Size  Field
+//   0       8     Identifier ("KS_TEX2\0")
+//   8       4     Width
+//   12      4     Height
+//   16      4     Compression level
+//   20      4     Number of textures
+//   24      40*N  Table of entries:
+//                   4  Cube position
+//                   4  Depth
+//                   4  Format (GL internal format)
+//                   4  Levels (mipmaps stored back to back, largest first)
+//                   8  Offset of the payload from the start of the file
+//                   8  Size of the payload in the file
+//                   8  Size of the payload once decompressed
+//
+// Payloads follow the table in the same order. With compression level 2 each
+// payload is a zlib stream wrapping GL compressed data.
+
+#define kTEX2HeaderSize 24
+#define kTEX2EntrySize 40
+
+// Entries beyond these are taken for a corrupt bundle. Payloads never take
+// more than 8 bytes per pixel, mipmaps included, once decompressed.
+#define kTEX2MaxLevels 16
+#define kTEX2MaxRawBytesPerPixel 8
+
+// Version 1 bundles ("KS_TEX") are raw dumps of these structs, one subheader
+// before each payload. They remain supported for older games.
+
+// TODO: We should convert all short vars to int for better speed here,
+// also read new defines.
+
+typedef struct {
+  char name[80];
+  short width;
+  short height;
+  short compressionLevel; // 0: None, 1: GL only, 2: GL & zlib
+  short numTextures;
+} TEXMainHeader;
+
+typedef struct {
+  short cubePosition;
+  short depth;
+  int size;
+  int format;
+} TEXSubHeader;
+
+struct TextureBundleEntry {
+  int cubePosition;
+  int depth;
+  int format;
+  int levels;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t rawSize; // Zero if unknown
+};
+
+////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////
+
+class TextureBundle {
+ public:
+  TextureBundle();
+  ~TextureBundle();
+
+  // Checks
+  static bool isBundle(const char* magic, size_t length);
+  bool isOpen();
+
+  // Gets
+  int compressionLevel();
+  const TextureBundleEntry& entry(int index);
+  int height();
+  int numTextures();
+  int version();
+  int width();
+
+  // State changes
+  void close();
+  bool open(const std::string& fromFileName);
+  // Reads the whole payload of the entry into the given buffer, which must
+  // hold at least entry(index).size bytes. Reading entries in order of their
+  // offsets never seeks.
+  bool read(int index, void* intoBuffer);
+  // Reads only part of the payload, starting at the given offset within it
+  bool read(int index, uint64_t offset, uint64_t size, void* intoBuffer);
+  static bool write(const std::string& toFileName, int width, int height,
+                    int compressionLevel,
+                    const std::vector<TextureBundleEntry>& arrayOfEntries,
+                    const std::vector<const void*>& arrayOfPayloads);
+
+ private:
+  std::vector<TextureBundleEntry> _arrayOfEntries;
+  int _compressionLevel;
+  uint64_t _fileSize;
+  FILE* _handle;
+  int _height;
+  uint64_t _position;
+  int _version;
+  int _width;
+
+  bool _measure(); // Finds the size of the file, then rewinds
+  bool _openVersion1();
+  bool _openVersion2();
+  bool _seek(uint64_t offset);
+
+  TextureBundle(const TextureBundle&);
+  void operator=(const TextureBundle&);
+};
+
+}
+
+#endif // DAGON_TEXTUREBUNDLE_H_
@@ -0,0 +1,303 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "TextureCompressor.h"
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+static int Pack565(const int* color) {
+  int r = (color[0] * 31 + 127) / 255;
+  int g = (color[1] * 63 + 127) / 255;
+  int b = (color[2] * 31 + 127) / 255;
+  return (r << 11) | (g << 5) | b;
+}
+
+static void Unpack565(int packed, int* color) {
+  int r = (packed >> 11) & 0x1F;
+  int g = (packed >> 5) & 0x3F;
+  int b = packed & 0x1F;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Gets
+////////////////////////////////////////////////////////////
+
+int TextureCompressor::blockSize(int format) {
+  switch (format) {
+    case kTexFormatBC1:
+      return 8;
+    case kTexFormatBC3:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+size_t TextureCompressor::chainSize(int format, int width, int height,
+                                    int levels) {
+  size_t size = 0;
+  for (int i = 0; i < levels; i++) {
+    size += levelSize(format, width, height);
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+  return size;
+}
+
+size_t TextureCompressor::levelSize(int format, int width, int height) {
+  return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) *
+         blockSize(format);
+}
+
+int TextureCompressor::numLevels(int width, int height) {
+  int size = width > height ? width : height;
+  int levels = 1;
+  while (size > 1) {
+    size /= 2;
+    levels++;
+  }
+  return levels;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - State changes
+////////////////////////////////////////////////////////////
+
+void TextureCompressor::compress(int format, const unsigned char* bitmap,
+                                 int width, int height, unsigned char* output,
+                                 int fromRow, int toRow) {
+  int blocksWide = (width + 3) / 4;
+  int size = blockSize(format);
+  unsigned char block[64];
+
+  for (int by = fromRow; by < toRow; by++) {
+    for (int bx = 0; bx < blocksWide; bx++) {
+      // Gather the block, repeating the edges of small levels
+      for (int y = 0; y < 4; y++) {
+        int py = by * 4 + y < height ? by * 4 + y : height - 1;
+        for (int x = 0; x < 4; x++) {
+          int px = bx * 4 + x < width ? bx * 4 + x : width - 1;
+          const unsigned char* pixel = &bitmap[(py * width + px) * 4];
+          unsigned char* target = &block[(y * 4 + x) * 4];
+          target[0] = pixel[0];
+          target[1] = pixel[1];
+          target[2] = pixel[2];
+          target[3] = pixel[3];
+        }
+      }
+
+      unsigned char* data = &output[(by * blocksWide + bx) * size];
+      if (format == kTexFormatBC3) {
+        _encodeAlpha(block, data);
+        data += 8;
+      }
+      _encodeColor(block, data);
+    }
+  }
+}
+
+void TextureCompressor::downsample(const unsigned char* bitmap,
+                                   int width, int height,
+                                   unsigned char* output, int channels) {
+  int outWidth = width > 1 ? width / 2 : 1;
+  int outHeight = height > 1 ? height / 2 : 1;
+
+  for (int y = 0; y < outHeight; y++) {
+    int y0 = y * 2;
+    int y1 = y0 + 1 < height ? y0 + 1 : height - 1;
+    for (int x = 0; x < outWidth; x++) {
+      int x0 = x * 2;
+      int x1 = x0 + 1 < width ? x0 + 1 : width - 1;
+      for (int c = 0; c < channels; c++) {
+        int sum = bitmap[(y0 * width + x0) * channels + c] +
+                  bitmap[(y0 * width + x1) * channels + c] +
+                  bitmap[(y1 * width + x0) * channels + c] +
+                  bitmap[(y1 * width + x1) * channels + c];
+        output[(y * outWidth + x) * channels + c] =
+          static_cast<unsigned char>((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Private methods
+////////////////////////////////////////////////////////////
+
+void TextureCompressor::_encodeAlpha(const unsigned char* block,
+                                     unsigned char* output) {
+  int a0 = 0;
+  int a1 = 255;
+  for (int i = 0; i < 16; i++) {
+    int alpha = block[i * 4 + 3];
+    if (alpha > a0) a0 = alpha;
+    if (alpha < a1) a1 = alpha;
+  }
+
+  output[0] = static_cast<unsigned char>(a0);
+  output[1] = static_cast<unsigned char>(a1);
+
+  // With a0 > a1 the palette interpolates six values between both ends
+  int palette[8];
+  palette[0] = a0;
+  palette[1] = a1;
+  for (int i = 1; i < 7; i++)
+    palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+
+  unsigned long long bits = 0;
+  for (int i = 0; i < 16; i++) {
+    int alpha = block[i * 4 + 3];
+    int best = 0;
+    int bestError = 256;
+    if (a0 != a1) {
+      for (int j = 0; j < 8; j++) {
+        int error = abs(alpha - palette[j]);
+        if (error < bestError) {
+          bestError = error;
+          best = j;
+        }
+      }
+    }
+    bits |= static_cast<unsigned long long>(best) << (i * 3);
+  }
+
+  for (int i = 0; i < 6; i++)
+    output[i + 2] = static_cast<unsigned char>((bits >> (i * 8)) & 0xFF);
+}
+
+void TextureCompressor::_encodeColor(const unsigned char* block,
+                                     unsigned char* output) {
+  // Find the principal axis of the colors in the block
+  float mean[3] = {0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 3; c++)
+      mean[c] += block[i * 4 + c];
+  }
+  for (int c = 0; c < 3; c++)
+    mean[c] /= 16.0f;
+
+  float covariance[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++) {
+    float r = block[i * 4] - mean[0];
+    float g = block[i * 4 + 1] - mean[1];
+    float b = block[i * 4 + 2] - mean[2];
+    covariance[0] += r * r;
+    covariance[1] += r * g;
+    covariance[2] += r * b;
+    covariance[3] += g * g;
+    covariance[4] += g * b;
+    covariance[5] += b * b;
+  }
+
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int i = 0; i < 4; i++) {
+    float r = covariance[0] * axis[0] + covariance[1] * axis[1] +
+              covariance[2] * axis[2];
+    float g = covariance[1] * axis[0] + covariance[3] * axis[1] +
+              covariance[4] * axis[2];
+    float b = covariance[2] * axis[0] + covariance[4] * axis[1] +
+              covariance[5] * axis[2];
+    float length = sqrtf(r * r + g * g + b * b);
+    if (length < 0.0001f)
+      break; // Flat block, any axis will do
+    axis[0] = r / length;
+    axis[1] = g / length;
+    axis[2] = b / length;
+  }
+
+  // The extremes along the axis become the endpoints
+  int minIndex = 0;
+  int maxIndex = 0;
+  float minDot = 0.0f;
+  float maxDot = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    float dot = block[i * 4] * axis[0] + block[i * 4 + 1] * axis[1] +
+                block[i * 4 + 2] * axis[2];
+    if (i == 0 || dot < minDot) {
+      minDot = dot;
+      minIndex = i;
+    }
+    if (i == 0 || dot > maxDot) {
+      maxDot = dot;
+      maxIndex = i;
+    }
+  }
+
+  int endpoint[3];
+  for (int c = 0; c < 3; c++)
+    endpoint[c] = block[maxIndex * 4 + c];
+  int color0 = Pack565(endpoint);
+  for (int c = 0; c < 3; c++)
+    endpoint[c] = block[minIndex * 4 + c];
+  int color1 = Pack565(endpoint);
+
+  // Keep the four color mode, which requires color0 > color1
+  if (color0 < color1) {
+    int swap = color0;
+    color0 = color1;
+    color1 = swap;
+  }
+
+  unsigned int bits = 0;
+  if (color0 != color1) {
+    int palette[4][3];
+    Unpack565(color0, palette[0]);
+    Unpack565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      int bestError = 0;
+      for (int j = 0; j < 4; j++) {
+        int error = 0;
+        for (int c = 0; c < 3; c++) {
+          int delta = block[i * 4 + c] - palette[j][c];
+          error += delta * delta;
+        }
+        if (j == 0 || error < bestError) {
+          bestError = error;
+          best = j;
+        }
+      }
+      bits |= static_cast<unsigned int>(best) << (i * 2);
+    }
+  }
+
+  output[0] = static_cast<unsigned char>(color0 & 0xFF);
+  output[1] = static_cast<unsigned char>(color0 >> 8);
+  output[2] = static_cast<unsigned char>(color1 & 0xFF);
+  output[3] = static_cast<unsigned char>(color1 >> 8);
+  output[4] = static_cast<unsigned char>(bits & 0xFF);
+  output[5] = static_cast<unsigned char>((bits >> 8) & 0xFF);
+  output[6] = static_cast<unsigned char>((bits >> 16) & 0xFF);
+  output[7] = static_cast<unsigned char>(bits >> 24);
+}
+
+}
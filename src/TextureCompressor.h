@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+#ifndef DAGON_TEXTURECOMPRESSOR_H_
+#define DAGON_TEXTURECOMPRESSOR_H_
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+// Same values as the GL enums, so they can be stored in bundles and passed
+// straight to glCompressedTexImage2D. Defined here because the packer
+// doesn't depend on GL.
+#define kTexFormatBC1 0x83F0 // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define kTexFormatBC3 0x83F3 // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+
+////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////
+
+// CPU encoder for the S3TC formats, plus the size arithmetic needed to walk
+// mipmap chains. Bitmaps are always 8-bit RGBA.
+
+class TextureCompressor {
+ public:
+  // Gets
+  static int blockSize(int format); // Zero if not a block format
+  static size_t chainSize(int format, int width, int height, int levels);
+  static size_t levelSize(int format, int width, int height);
+  static int numLevels(int width, int height);
+
+  // State changes
+  // Encodes the rows of blocks in [fromRow, toRow), so that several threads
+  // can share the same level.
+  static void compress(int format, const unsigned char* bitmap,
+                       int width, int height, unsigned char* output,
+                       int fromRow, int toRow);
+  // Box filter to half size, rounding down but never below one pixel.
+  // RGBA unless told otherwise.
+  static void downsample(const unsigned char* bitmap, int width, int height,
+                         unsigned char* output, int channels = 4);
+
+ private:
+  static void _encodeAlpha(const unsigned char* block, unsigned char* output);
+  static void _encodeColor(const unsigned char* block, unsigned char* output);
+};
+
+}
+
+#endif // DAGON_TEXTURECOMPRESSOR_H_
@@ -15,12 +15,26 @@
 // Headers
 ////////////////////////////////////////////////////////////
 
+#include <math.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <SDL2/SDL_cpuinfo.h>
+#include <SDL2/SDL_timer.h>
+
+#include "CameraManager.h"
 #include "Config.h"
+#include "Defines.h"
 #include "Log.h"
 #include "Node.h"
-#include "Room.h"
 #include "Spot.h"
+#include "TextureAtlas.h"
+#include "TextureBundle.h"
 #include "TextureManager.h"
+#include "TextureTiles.h"
+#include "TextureUploader.h"
 
 namespace dagon {
 
@@ -28,7 +42,9 @@ namespace dagon {
 // Definitions
 ////////////////////////////////////////////////////////////
 
-bool TextureSort(Texture* t1, Texture* t2);
+// Sizes of the faces that may be shipped, smallest first
+static const int TextureTiers[] = {1024, 2048, 4096};
+static const int kNumOfTiers = sizeof(TextureTiers) / sizeof(int);
 
 ////////////////////////////////////////////////////////////
 // Implementation - Constructor
@@ -38,7 +54,24 @@ TextureManager::TextureManager() :
 config(Config::instance()),
 log(Log::instance())
 {
-  _roomToPreload = NULL;
+  _frame = 0;
+  _hasImageSizes = false;
+  _imageHits = 0;
+  _imageMisses = 0;
+  _isImageSizesDirty = false;
+  _isRunning = false;
+  _isSwitching = false;
+  _prefetchHits = 0;
+  _prefetchMisses = 0;
+  _switchLatency = 0.0;
+  _switchStart = 0;
+  _residentBytes = 0;
+  _hasTier = false;
+  _tier = kDefTexSize;
+  _mutex = SDL_CreateMutex();
+  if (!_mutex)
+    log.error(kModTexture, "%s", kString18001);
+  _condition = SDL_CreateCond();
 }
 
 ////////////////////////////////////////////////////////////
@@ -56,12 +89,50 @@ TextureManager::~TextureManager() {
       ++it;
     }
   }
+  
+  // Faces are gone, and so are the cube maps
+  std::vector<TextureCube*>::iterator cube = _arrayOfCubes.begin();
+  while (cube != _arrayOfCubes.end()) {
+    delete *cube;
+    ++cube;
+  }
+  
+  // Images that were never released, such as cursors
+  std::unordered_map<Texture*, int>::iterator image;
+  image = _imageReferences.begin();
+  while (image != _imageReferences.end()) {
+    delete image->first;
+    ++image;
+  }
+  
+  SDL_DestroyCond(_condition);
+  SDL_DestroyMutex(_mutex);
 }
 
 ////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////
 
+Texture* TextureManager::acquireImage(const std::string& fromFileName) {
+  Texture* texture;
+  
+  std::unordered_map<std::string, Texture*>::iterator it;
+  it = _imageCache.find(fromFileName);
+  if (it != _imageCache.end()) {
+    _imageHits++;
+    texture = it->second;
+  } else {
+    _imageMisses++;
+    texture = new Texture;
+    texture->setAtlasable(true);
+    texture->setResource(fromFileName);
+    _imageCache[fromFileName] = texture;
+  }
+  
+  _imageReferences[texture]++;
+  return texture;
+}
+
 void TextureManager::appendTextureToBundle(const char* nameOfBundle, Texture* textureToAppend) {
   // This function will store individual textures to a bundle
 }
@@ -70,32 +141,118 @@ void TextureManager::createBundle(const char* nameOfBundle) {
   // This function will create bundles to store textures
 }
 
+unsigned int TextureManager::imageHits() {
+  return _imageHits;
+}
+
+unsigned int TextureManager::imageMisses() {
+  return _imageMisses;
+}
+
+size_t TextureManager::imageSavedBytes() {
+  size_t bytes = 0;
+  
+  std::unordered_map<Texture*, int>::iterator it = _imageReferences.begin();
+  while (it != _imageReferences.end()) {
+    bytes += (it->second - 1) * it->first->residentBytes();
+    ++it;
+  }
+  
+  return bytes;
+}
+
+bool TextureManager::imageSize(Texture* ofImage, int& width, int& height) {
+  if (ofImage->isLoaded() || ofImage->isBitmapLoaded()) {
+    width = ofImage->width();
+    height = ofImage->height();
+    return true;
+  }
+  
+  struct stat info;
+  if (stat(ofImage->resource().c_str(), &info) != 0)
+    return false;
+  
+  if (!_hasImageSizes)
+    _loadImageSizes();
+  
+  std::unordered_map<std::string, ImageSize>::iterator it;
+  it = _imageSizes.find(ofImage->resource());
+  if (it != _imageSizes.end() && it->second.modified == info.st_mtime) {
+    width = it->second.width;
+    height = it->second.height;
+    return true;
+  }
+  
+  if (!ofImage->probe())
+    return false;
+  
+  ImageSize size;
+  size.modified = info.st_mtime;
+  size.width = width = ofImage->width();
+  size.height = height = ofImage->height();
+  _imageSizes[ofImage->resource()] = size;
+  _isImageSizesDirty = true;
+  
+  return true;
+}
+
 int TextureManager::itemsInBundle(const char* nameOfBundle) {
   // This one should return the number of textures in a bundle
   return 0;
 }
 
-void TextureManager::flush() {
-  // This function is called every time a switch is performed
-  // and unloads the least used textures when necessary
-  
-  long texturesToUnload = _arrayOfActiveTextures.size() - kMaxActiveTextures;
+void TextureManager::flush(Node* currentNode) {
+  // This function is called every time a switch is performed. The textures
+  // of the new node are protected, and the least recently used ones are
+  // unloaded when over budget.
+  _pinnedTextures.clear();
+  _isSwitching = true;
+  _switchStart = SDL_GetPerformanceCounter();
   
-  while (texturesToUnload > 0) {
-    _arrayOfActiveTextures.front()->unload();
-    _arrayOfActiveTextures.erase(_arrayOfActiveTextures.begin());
-    
-    texturesToUnload--;
+  if (currentNode->hasSpots()) {
+    currentNode->beginIteratingSpots();
+    do {
+      Spot* spot = currentNode->currentSpot();
+      if (spot->hasTexture())
+        _pinnedTextures.insert(spot->texture());
+    } while (currentNode->iterateSpots());
   }
+  
+  _evict();
+  
+  // The node we just left may be waiting for another tier
+  _retier();
+}
+
+unsigned int TextureManager::frame() {
+  return _frame;
 }
 
 void TextureManager::init() {
-  /*_preloaderThread = thread([&](){
-   chrono::milliseconds dura(1);
-   while (TextureManager::instance().updatePreloader()) {
-   this_thread::sleep_for(dura);
-   }
-   });*/
+  TextureUploader::instance().init();
+  
+  // Leave one core to the main thread
+  int numOfWorkers = SDL_GetCPUCount() - 1;
+  if (numOfWorkers > kMaxTextureWorkers)
+    numOfWorkers = kMaxTextureWorkers;
+  else if (numOfWorkers < 1)
+    numOfWorkers = 1;
+  
+  _isRunning = true;
+  
+  for (int i = 0; i < numOfWorkers; i++) {
+    SDL_Thread* thread = SDL_CreateThread(_runThread, "TextureManager",
+                                          (void*)NULL);
+    if (thread) {
+      _arrayOfWorkers.push_back(thread);
+    } else {
+      log.error(kModTexture, "%s:%s", kString18003, SDL_GetError());
+    }
+  }
+  
+  // Without workers every texture is simply loaded on request
+  if (_arrayOfWorkers.empty())
+    _isRunning = false;
 }
 
 void TextureManager::registerTexture(Texture* target) {
@@ -126,8 +283,35 @@ void TextureManager::registerTexture(Texture* target) {
   // It's the responsibility of another module to generate the res path accordingly
 }
 
+void TextureManager::releaseImage(Texture* target) {
+  std::unordered_map<Texture*, int>::iterator it;
+  it = _imageReferences.find(target);
+  
+  if (it != _imageReferences.end() && --it->second == 0) {
+    _imageReferences.erase(it);
+    _imageCache.erase(target->resource());
+    delete target;
+  }
+}
+
 void TextureManager::requestBundle(Node* forNode) {
   if (forNode->hasBundleName()) {
+    // The faces are drawn from a single cube map when supported
+    TextureCube* cube = NULL;
+    if (GLEW_VERSION_1_3 || GLEW_ARB_texture_cube_map) {
+      cube = new TextureCube;
+      cube->ident = 0;
+      cube->faces = 0;
+      cube->detachedFaces = 0;
+      cube->firstFace = 0;
+      cube->needsMipmaps = false;
+      cube->residentBytes = 0;
+      _arrayOfCubes.push_back(cube);
+    }
+    
+    TieredBundle bundle;
+    bundle.tier = kDefTexSize;
+    
     for (int i = 0; i < 6; i++) {
       std::vector<int> arrayOfCoordinates;
       // We ensure the texture is properly stretched, so we take the default cube size
@@ -141,69 +325,726 @@ void TextureManager::requestBundle(Node* forNode) {
       
       spot->setTexture(texture);
       spot->texture()->setIndexInBundle(i);
+      spot->texture()->setMipmapped(true);
+      spot->texture()->setTiled(config.texTiling);
+      if (cube) {
+        cube->arrayOfFaces[i] = texture;
+        texture->setCube(cube, i);
+      }
       
       // In this case, the filename is generated from the name
       // of the texture
       spot->texture()->setName(forNode->bundleName().c_str());
       
       registerTexture(spot->texture());
+      bundle.arrayOfFaces[i] = texture;
+      bundle.arrayOfResources[i] = texture->resource();
       
       forNode->addSpot(spot);
     }
+    
+    _arrayOfBundles.push_back(bundle);
+    if (_tier != kDefTexSize)
+      _retier();
   }
   
   // Possibly raise an error if this fails
 }
 
+void TextureManager::prefetchLinks(Node* fromNode) {
+  if (!_isRunning)
+    return;
+  
+  // Find the nodes we can reach from here. Note we can't iterate the spots
+  // of another node while iterating these, so we collect them first.
+  std::vector<Node*> arrayOfLinks;
+  if (fromNode->hasSpots()) {
+    fromNode->beginIteratingSpots();
+    do {
+      Spot* spot = fromNode->currentSpot();
+      
+      if (spot->hasAction() && spot->action()->type == kActionSwitch) {
+        Object* target = spot->action()->target;
+        
+        if (target && target != fromNode &&
+            (target->type() == kObjectNode || target->type() == kObjectSlide)) {
+          Node* node = static_cast<Node*>(target);
+          if (std::find(arrayOfLinks.begin(), arrayOfLinks.end(),
+                        node) == arrayOfLinks.end())
+            arrayOfLinks.push_back(node);
+        }
+      }
+    } while (fromNode->iterateSpots());
+  }
+  
+  // Gather their textures in the order of the links
+  std::vector<Texture*> arrayOfWanted;
+  std::vector<Node*>::iterator it = arrayOfLinks.begin();
+  while (it != arrayOfLinks.end()) {
+    Node* node = *it;
+    if (node->hasSpots()) {
+      node->beginIteratingSpots();
+      do {
+        Spot* spot = node->currentSpot();
+        
+        if (spot->hasTexture() && spot->texture()->hasResource() &&
+            !spot->texture()->isLoaded() &&
+            arrayOfWanted.size() < kMaxPrefetchedTextures)
+          arrayOfWanted.push_back(spot->texture());
+      } while (node->iterateSpots());
+    }
+    ++it;
+  }
+  
+  std::unordered_set<Texture*> wanted(arrayOfWanted.begin(),
+                                      arrayOfWanted.end());
+  
+  if (SDL_LockMutex(_mutex) == 0) {
+    // Cancel whatever we were prefetching for another destination
+    std::deque<Texture*>::iterator queued = _prefetchQueue.begin();
+    while (queued != _prefetchQueue.end()) {
+      if (!wanted.count(*queued)) {
+        _pendingTextures.erase(*queued);
+        queued = _prefetchQueue.erase(queued);
+      }
+      else ++queued;
+    }
+    
+    // Workers will discard the ones in progress once done
+    std::unordered_map<Texture*, int>::iterator pending;
+    pending = _pendingTextures.begin();
+    while (pending != _pendingTextures.end()) {
+      if (pending->second == kTexturePrefetching &&
+          !wanted.count(pending->first))
+        pending = _pendingTextures.erase(pending);
+      else ++pending;
+    }
+    
+    std::unordered_set<Texture*>::iterator prefetched;
+    prefetched = _prefetchedTextures.begin();
+    while (prefetched != _prefetchedTextures.end()) {
+      if (!wanted.count(*prefetched)) {
+        (*prefetched)->unloadBitmap();
+        prefetched = _prefetchedTextures.erase(prefetched);
+      }
+      else ++prefetched;
+    }
+    
+    // Now queue the new ones
+    std::vector<Texture*>::iterator texture = arrayOfWanted.begin();
+    while (texture != arrayOfWanted.end()) {
+      if (!_pendingTextures.count(*texture) &&
+          !_prefetchedTextures.count(*texture)) {
+        _pendingTextures[*texture] = kTexturePrefetching;
+        _prefetchQueue.push_back(*texture);
+      }
+      ++texture;
+    }
+    
+    SDL_CondBroadcast(_condition);
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+}
+
+unsigned int TextureManager::prefetchHits() {
+  return _prefetchHits;
+}
+
+unsigned int TextureManager::prefetchMisses() {
+  return _prefetchMisses;
+}
+
+void TextureManager::queueTexture(Texture* target) {
+  if (target->isLoaded() || !target->hasResource() || !_isRunning) {
+    // Nothing to decode, or nobody to decode it
+    this->requestTexture(target);
+    return;
+  }
+  
+  if (SDL_LockMutex(_mutex) == 0) {
+    if (_prefetchedTextures.erase(target) && target->isBitmapLoaded()) {
+      // Decoded in advance, so it goes straight to the upload queue
+      _prefetchHits++;
+      _pendingTextures[target] = kTextureDecoding;
+      if (target->isPreviewLoaded())
+        _previewQueue.push_back(target);
+      _uploadQueue.push_back(target);
+    } else {
+      _prefetchMisses++;
+      
+      std::unordered_map<Texture*, int>::iterator it;
+      it = _pendingTextures.find(target);
+      if (it == _pendingTextures.end()) {
+        _pendingTextures[target] = kTextureDecoding;
+        _decodeQueue.push_back(target);
+        SDL_CondSignal(_condition);
+      } else if (it->second == kTexturePrefetching) {
+        // Promote it. If a worker is already decoding it, the worker
+        // will hand it over for upload when done.
+        it->second = kTextureDecoding;
+        
+        std::deque<Texture*>::iterator queued;
+        queued = std::find(_prefetchQueue.begin(), _prefetchQueue.end(),
+                           target);
+        if (queued != _prefetchQueue.end()) {
+          _prefetchQueue.erase(queued);
+          _decodeQueue.push_back(target);
+          SDL_CondSignal(_condition);
+        }
+      }
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+}
+
 void TextureManager::requestTexture(Texture* target) {
   if (!target->isLoaded()) {
+    // If a worker is decoding this texture, this waits until it's done
+    // and only performs the upload
     target->load();
-    
-    _arrayOfActiveTextures.push_back(target);
   }
   
-  target->increaseUsageCount();
+  if (target->isLoaded()) {
+    target->increaseUsageCount();
+    _touch(target);
+    _evict();
+  }
+}
+
+size_t TextureManager::residentBytes() {
+  return _residentBytes;
+}
+
+void TextureManager::selectTier(int width, int height) {
+  // Texels of a face needed for one per pixel. Faces span 90 degrees, so a
+  // face is as large as the screen divided by the tangent of half the fov.
+  float fov = CameraManager::instance().fieldOfView();
+  double needed = height / tan(fov * M_PI / 360.0);
+  
+  // Closest tier, in powers of two
+  int tier = 0;
+  for (int i = 1; i < kNumOfTiers; i++) {
+    if (fabs(log2(needed / TextureTiers[i])) <
+        fabs(log2(needed / TextureTiers[tier])))
+      tier = i;
+  }
+  
+  // Uncompressed faces are RGB, plus a third for the mipmaps
+  size_t budget = static_cast<size_t>(config.texMemoryBudget) * 1024 * 1024;
+  size_t bytesPerTexel = config.texCompression ? 1 : 3;
+  const char* reason = kString10011;
+  while (tier > 0) {
+    size_t size = TextureTiers[tier];
+    size_t bytes = (6 * size * size * bytesPerTexel * 4) / 3;
+    if (bytes * kTierMinNodes <= budget)
+      break;
+    reason = kString10012;
+    tier--;
+  }
   
-  sort(_arrayOfActiveTextures.begin(), _arrayOfActiveTextures.end(), TextureSort);
+  if (TextureTiers[tier] != _tier || !_hasTier) {
+    _hasTier = true;
+    _tier = TextureTiers[tier];
+    log.info(kModTexture, "%s: %d (%s, %dx%d at %.0f degrees, %d MB)",
+             kString10010, _tier, reason, width, height, fov,
+             config.texMemoryBudget);
+    _retier();
+  }
 }
 
-void TextureManager::setRoomToPreload(Room* theRoom) {
-  _roomToPreload = theRoom;
+double TextureManager::switchLatency() {
+  return _switchLatency;
 }
 
-bool TextureManager::updatePreloader() {
-  if (_roomToPreload) {
-    if (_roomToPreload->hasNodes()) {
-      _roomToPreload->beginIteratingNodes();
-      do {
-        Node* node = _roomToPreload->iterator();
-        if (node->hasSpots()) {
-          node->beginIteratingSpots();
-          do {
-            Spot* spot = node->currentSpot();
-            
-            if (spot->hasTexture()) {
-              if (!spot->texture()->isLoaded()) {
-                spot->texture()->loadBitmap();
-                
-                //_arrayOfActiveTextures.push_back(spot->texture());
-              }
-            }
-          } while (node->iterateSpots());
-        }
-      } while (_roomToPreload->iterateNodes());
-    }
+void TextureManager::textureStats(std::vector<TextureStats>& arrayOfStats) {
+  std::vector<Texture*> arrayOfTextures = _arrayOfTextures;
+  std::unordered_map<Texture*, int>::iterator image;
+  image = _imageReferences.begin();
+  while (image != _imageReferences.end()) {
+    arrayOfTextures.push_back(image->first);
+    ++image;
   }
   
-  return true;
+  std::vector<Texture*>::iterator it = arrayOfTextures.begin();
+  while (it != arrayOfTextures.end()) {
+    Texture* texture = *it;
+    TextureStats stats;
+    stats.resource = texture->resource();
+    stats.indexInBundle = texture->indexInBundle();
+    stats.residentBytes = texture->residentBytes();
+    stats.decodeTime = texture->decodeTime();
+    stats.uploadTime = texture->uploadTime();
+    stats.lastUsedFrame = texture->lastUsedFrame();
+    stats.evictionCount = texture->evictionCount();
+    arrayOfStats.push_back(stats);
+    ++it;
+  }
+  
+  std::sort(arrayOfStats.begin(), arrayOfStats.end(), _isLarger);
+}
+
+void TextureManager::terminate() {
+  if (SDL_LockMutex(_mutex) == 0) {
+    _isRunning = false;
+    _decodeQueue.clear();
+    _finishQueue.clear();
+    _prefetchQueue.clear();
+    _previewQueue.clear();
+    SDL_CondBroadcast(_condition);
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+  
+  std::vector<SDL_Thread*>::iterator it = _arrayOfWorkers.begin();
+  while (it != _arrayOfWorkers.end()) {
+    int threadReturnValue;
+    SDL_WaitThread(*it, &threadReturnValue);
+    ++it;
+  }
+  _arrayOfWorkers.clear();
+  
+  TextureUploader::instance().terminate();
+  TextureAtlas::instance().terminate();
+  TextureTiles::instance().terminate();
+  
+  if (_isImageSizesDirty)
+    _saveImageSizes();
+}
+
+int TextureManager::tier() {
+  return _tier;
+}
+
+void TextureManager::touchTexture(Texture* target) {
+  std::unordered_map<Texture*, std::list<Texture*>::iterator>::iterator it;
+  it = _residentIndex.find(_unitOf(target));
+  
+  // Others aren't managed, or not loaded yet
+  if (it != _residentIndex.end())
+    _residentTextures.splice(_residentTextures.end(), _residentTextures,
+                             it->second);
+}
+
+void TextureManager::update() {
+  // Uploads decoded bitmaps until the budget for this frame is exhausted.
+  // We always upload at least one so that the queue never stalls.
+  _frame++;
+  TextureUploader::instance().update();
+  
+  // Previews are small, so all of them go out right away
+  std::deque<Texture*> previews;
+  if (SDL_LockMutex(_mutex) == 0) {
+    previews.swap(_previewQueue);
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+  
+  std::deque<Texture*>::iterator preview = previews.begin();
+  while (preview != previews.end()) {
+    (*preview)->uploadPreview();
+    ++preview;
+  }
+  
+  Uint64 startTime = SDL_GetPerformanceCounter();
+  Uint64 budget = (SDL_GetPerformanceFrequency() *
+                   config.texUploadBudget) / 1000;
+  
+  do {
+    Texture* texture = NULL;
+    
+    if (SDL_LockMutex(_mutex) == 0) {
+      if (!_uploadQueue.empty()) {
+        texture = _uploadQueue.front();
+        _uploadQueue.pop_front();
+        _pendingTextures.erase(texture);
+      }
+      SDL_UnlockMutex(_mutex);
+    } else {
+      log.error(kModTexture, "%s", kString18002);
+    }
+    
+    if (!texture)
+      break;
+    
+    // The texture may have been requested or flushed in the meantime
+    if (!texture->isLoaded() && texture->isBitmapLoaded())
+      this->requestTexture(texture);
+  } while ((SDL_GetPerformanceCounter() - startTime) < budget);
+  
+  if (_isSwitching && SDL_LockMutex(_mutex) == 0) {
+    bool isDone = true;
+    std::unordered_set<Texture*>::iterator it = _pinnedTextures.begin();
+    while (it != _pinnedTextures.end()) {
+      if (_pendingTextures.count(*it)) {
+        isDone = false;
+        break;
+      }
+      ++it;
+    }
+    SDL_UnlockMutex(_mutex);
+    
+    if (isDone) {
+      _switchLatency = ((SDL_GetPerformanceCounter() - _switchStart) *
+                        1000.0) / SDL_GetPerformanceFrequency();
+      _isSwitching = false;
+    }
+  }
 }
 
 ////////////////////////////////////////////////////////////
 // Implementation - Private methods
 ////////////////////////////////////////////////////////////
 
-bool TextureSort(Texture* t1, Texture* t2) {
-  return t1->usageCount() < t2->usageCount();
+// Must be called with the mutex locked
+void TextureManager::_complete(Texture* target) {
+  std::unordered_map<Texture*, int>::iterator it;
+  it = _pendingTextures.find(target);
+  
+  if (it == _pendingTextures.end()) {
+    // The prefetch was cancelled while we were decoding
+    if (!_prefetchedTextures.count(target))
+      target->unloadBitmap();
+  } else if (!target->isBitmapLoaded()) {
+    // Failed, or loaded by the main thread while we were waiting
+    _pendingTextures.erase(it);
+  } else if (it->second == kTextureDecoding) {
+    if (target->isPreviewLoaded())
+      _previewQueue.push_back(target);
+    _uploadQueue.push_back(target);
+  } else {
+    _prefetchedTextures.insert(target);
+    _pendingTextures.erase(it);
+  }
+}
+
+// Asynchronous method
+bool TextureManager::_decode() {
+  std::vector<Texture*> arrayOfTextures;
+  
+  if (SDL_LockMutex(_mutex) == 0) {
+    while (_isRunning && _decodeQueue.empty() && _finishQueue.empty() &&
+           _prefetchQueue.empty())
+      SDL_CondWait(_condition, _mutex);
+    
+    if (!_isRunning) {
+      SDL_UnlockMutex(_mutex);
+      return false;
+    }
+    
+    if (!_finishQueue.empty()) {
+      Texture* texture = _finishQueue.front();
+      _finishQueue.pop_front();
+      SDL_UnlockMutex(_mutex);
+      
+      _finish(texture);
+      return true;
+    }
+    
+    // Textures of the current node always come first
+    std::deque<Texture*>* queue;
+    if (!_decodeQueue.empty())
+      queue = &_decodeQueue;
+    else
+      queue = &_prefetchQueue;
+    
+    arrayOfTextures.push_back(queue->front());
+    queue->pop_front();
+    
+    // Faces sharing the same bundle are taken along, so the file is opened
+    // once and read front to back
+    std::string resource = arrayOfTextures.front()->resource();
+    std::deque<Texture*>* queues[] = {&_decodeQueue, &_prefetchQueue};
+    for (int i = 0; i < 2; i++) {
+      std::deque<Texture*>::iterator it = queues[i]->begin();
+      while (it != queues[i]->end()) {
+        if ((*it)->resource() == resource) {
+          arrayOfTextures.push_back(*it);
+          it = queues[i]->erase(it);
+        }
+        else ++it;
+      }
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+    return false;
+  }
+  
+  TextureBundle bundle;
+  if (arrayOfTextures.size() > 1 &&
+      bundle.open(arrayOfTextures.front()->resource())) {
+    // Follow the order of the payloads in the file
+    std::vector<std::pair<uint64_t, Texture*> > arrayOfReads;
+    std::vector<Texture*>::iterator it = arrayOfTextures.begin();
+    while (it != arrayOfTextures.end()) {
+      int index = (*it)->indexInBundle();
+      uint64_t offset = ~static_cast<uint64_t>(0); // Invalid ones go last
+      if (index >= 0 && index < bundle.numTextures())
+        offset = bundle.entry(index).offset;
+      arrayOfReads.push_back(std::make_pair(offset, *it));
+      ++it;
+    }
+    std::sort(arrayOfReads.begin(), arrayOfReads.end());
+    for (size_t i = 0; i < arrayOfReads.size(); i++)
+      arrayOfTextures[i] = arrayOfReads[i].second;
+    
+    // Stored mipmaps are a fraction of the size, so they're read first to
+    // show the node as soon as possible
+    bool hasPreviews = false;
+    it = arrayOfTextures.begin();
+    while (it != arrayOfTextures.end()) {
+      (*it)->loadPreview(bundle);
+      if ((*it)->isPreviewLoaded())
+        hasPreviews = true;
+      ++it;
+    }
+    
+    if (hasPreviews && SDL_LockMutex(_mutex) == 0) {
+      it = arrayOfTextures.begin();
+      while (it != arrayOfTextures.end()) {
+        std::unordered_map<Texture*, int>::iterator pending;
+        pending = _pendingTextures.find(*it);
+        if (pending != _pendingTextures.end() &&
+            pending->second == kTextureDecoding && (*it)->isPreviewLoaded())
+          _previewQueue.push_back(*it);
+        ++it;
+      }
+      SDL_UnlockMutex(_mutex);
+    }
+    
+    it = arrayOfTextures.begin();
+    while (it != arrayOfTextures.end()) {
+      (*it)->loadBitmap(bundle);
+      ++it;
+    }
+    bundle.close();
+  } else {
+    std::vector<Texture*>::iterator it = arrayOfTextures.begin();
+    while (it != arrayOfTextures.end()) {
+      (*it)->loadBitmap();
+      ++it;
+    }
+  }
+  
+  // Reading is sequential, but the rest of the work on each face isn't, so
+  // other workers take all of them but the first
+  if (arrayOfTextures.size() > 1) {
+    if (SDL_LockMutex(_mutex) == 0) {
+      for (size_t i = 1; i < arrayOfTextures.size(); i++)
+        _finishQueue.push_back(arrayOfTextures[i]);
+      SDL_CondBroadcast(_condition);
+      SDL_UnlockMutex(_mutex);
+    } else {
+      log.error(kModTexture, "%s", kString18002);
+    }
+  }
+  
+  _finish(arrayOfTextures.front());
+  return true;
+}
+
+void TextureManager::_evict() {
+  size_t budget = static_cast<size_t>(config.texMemoryBudget) * 1024 * 1024;
+  
+  std::list<Texture*>::iterator it = _residentTextures.begin();
+  while (_residentBytes > budget && it != _residentTextures.end()) {
+    Texture* texture = *it;
+    
+    if (_pinnedTextures.count(texture)) {
+      ++it;
+      continue;
+    }
+    
+    // The storage of a cube map goes only once all its faces do
+    _residentBytes -= _unitBytes(texture);
+    TextureCube* cube = texture->cube();
+    for (int i = 0; i < (cube ? 6 : 1); i++) {
+      Texture* face = cube ? cube->arrayOfFaces[i] : texture;
+      if (cube && (cube->detachedFaces & (1 << i)))
+        continue; // Resident on its own
+      face->increaseEvictionCount();
+      face->unload();
+    }
+    _residentIndex.erase(texture);
+    it = _residentTextures.erase(it);
+  }
+}
+
+bool TextureManager::_isLarger(const TextureStats& stats,
+                              const TextureStats& otherStats) {
+  return stats.residentBytes > otherStats.residentBytes;
+}
+
+// Asynchronous method
+void TextureManager::_finish(Texture* target) {
+  // Bitmaps without stored mipmaps are scaled down here
+  target->inflateBitmap();
+  target->loadPreview();
+  
+  if (SDL_LockMutex(_mutex) == 0) {
+    _complete(target);
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModTexture, "%s", kString18002);
+  }
+}
+
+void TextureManager::_loadImageSizes() {
+  // One image per line: modification time, width, height and path
+  FILE* fh = fopen(config.path(kPathUserData, kDefImageSizesFile,
+                               kObjectGeneric).c_str(), "r");
+  if (fh) {
+    char line[4096];
+    while (fgets(line, sizeof(line), fh)) {
+      long long modified;
+      int width, height, length;
+      if (sscanf(line, "%lld %d %d %n", &modified, &width, &height,
+                 &length) == 3) {
+        std::string path = line + length;
+        while (!path.empty() && (path[path.size() - 1] == '\n' ||
+                                 path[path.size() - 1] == '\r'))
+          path.erase(path.size() - 1);
+        
+        ImageSize size;
+        size.modified = static_cast<time_t>(modified);
+        size.width = width;
+        size.height = height;
+        _imageSizes[path] = size;
+      }
+    }
+    fclose(fh);
+  }
+  
+  _hasImageSizes = true;
+}
+
+void TextureManager::_retier() {
+  std::vector<TieredBundle>::iterator bundle = _arrayOfBundles.begin();
+  while (bundle != _arrayOfBundles.end()) {
+    if (bundle->tier == _tier) {
+      ++bundle;
+      continue;
+    }
+    
+    // Faces in use or being decoded are left for a later switch
+    bool isBusy = false;
+    if (SDL_LockMutex(_mutex) == 0) {
+      for (int i = 0; i < 6; i++) {
+        Texture* face = bundle->arrayOfFaces[i];
+        if (_pinnedTextures.count(face) || _pendingTextures.count(face))
+          isBusy = true;
+      }
+      
+      if (!isBusy) {
+        for (int i = 0; i < 6; i++) {
+          if (_prefetchedTextures.erase(bundle->arrayOfFaces[i]))
+            bundle->arrayOfFaces[i]->unloadBitmap();
+        }
+      }
+      SDL_UnlockMutex(_mutex);
+    } else {
+      log.error(kModTexture, "%s", kString18002);
+      return;
+    }
+    
+    if (!isBusy) {
+      for (int i = 0; i < 6; i++) {
+        Texture* face = bundle->arrayOfFaces[i];
+        std::unordered_map<Texture*,
+                           std::list<Texture*>::iterator>::iterator it;
+        it = _residentIndex.find(_unitOf(face));
+        if (it != _residentIndex.end()) {
+          _residentBytes -= _unitBytes(it->first);
+          _residentTextures.erase(it->second);
+          _residentIndex.erase(it);
+        }
+        face->unload();
+        face->setResource(_tierPath(bundle->arrayOfResources[i], _tier));
+      }
+      bundle->tier = _tier;
+    }
+    ++bundle;
+  }
+}
+
+int TextureManager::_runThread(void *ptr) {
+  while (TextureManager::instance()._decode()) {
+    // Loop until the manager is terminated
+  }
+  return 0;
+}
+
+void TextureManager::_saveImageSizes() {
+  FILE* fh = fopen(config.path(kPathUserData, kDefImageSizesFile,
+                               kObjectGeneric).c_str(), "w");
+  if (fh) {
+    std::unordered_map<std::string, ImageSize>::iterator it;
+    it = _imageSizes.begin();
+    while (it != _imageSizes.end()) {
+      fprintf(fh, "%lld %d %d %s\n",
+              static_cast<long long>(it->second.modified),
+              it->second.width, it->second.height, it->first.c_str());
+      ++it;
+    }
+    fclose(fh);
+    _isImageSizesDirty = false;
+  }
+}
+
+// Falls back to the default tier when the file wasn't shipped
+std::string TextureManager::_tierPath(const std::string& ofResource,
+                                      int tier) {
+  if (tier == kDefTexSize)
+    return ofResource;
+  
+  size_t dot = ofResource.find_last_of('.');
+  size_t slash = ofResource.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = ofResource.size();
+  
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "@%d", tier);
+  std::string path = ofResource.substr(0, dot) + suffix +
+                     ofResource.substr(dot);
+  
+  struct stat info;
+  if (stat(path.c_str(), &info) == 0)
+    return path;
+  else
+    return ofResource;
+}
+
+void TextureManager::_touch(Texture* target) {
+  std::unordered_map<Texture*, std::list<Texture*>::iterator>::iterator it;
+  target = _unitOf(target);
+  it = _residentIndex.find(target);
+  
+  if (it != _residentIndex.end()) {
+    // Move to the back, the most recently used
+    _residentTextures.splice(_residentTextures.end(), _residentTextures,
+                             it->second);
+  } else {
+    _residentIndex[target] = _residentTextures.insert(_residentTextures.end(),
+                                                      target);
+    _residentBytes += _unitBytes(target);
+  }
+}
+
+Texture* TextureManager::_unitOf(Texture* target) {
+  // The first face uploaded is never detached from its cube
+  TextureCube* cube = target->cube();
+  return cube ? cube->arrayOfFaces[cube->firstFace] : target;
+}
+
+size_t TextureManager::_unitBytes(Texture* unit) {
+  TextureCube* cube = unit->cube();
+  return cube ? cube->residentBytes : unit->residentBytes();
 }
   
 }
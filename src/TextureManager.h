@@ -18,6 +18,17 @@
 // Headers
 ////////////////////////////////////////////////////////////
 
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+
+#include <time.h>
+
+#include <deque>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "Platform.h"
 #include "Texture.h"
 
@@ -29,15 +40,51 @@ namespace dagon {
 
 // TODO: This class should be a singleton
 
-// This is temporary until we actually test how much memory is available.
-// NOT accurate! It's only a reference value since textures are flushed
-// before the next switch.
-#define kMaxActiveTextures 18
+// Upper limit of threads decoding bitmaps in the background
+#define kMaxTextureWorkers 4
+
+// Upper limit of bitmaps decoded ahead of time for neighbouring nodes.
+// Each 2048x2048 RGB face takes 12 MB of system memory.
+#define kMaxPrefetchedTextures 24
+
+// Nodes that should fit in the memory budget at once when choosing a
+// resolution tier: the current one and the one we're heading to
+#define kTierMinNodes 2
+
+enum TexturePendingStates {
+  kTextureDecoding, // Will be uploaded as soon as it's decoded
+  kTexturePrefetching // Will be kept in client memory once decoded
+};
+
+// Size of an image as of its last modification, saved across sessions
+struct ImageSize {
+  time_t modified;
+  int width;
+  int height;
+};
+
+// Faces of a node, which are switched to another tier together. Tiers other
+// than the default are files named after it, such as node@1024.tex.
+struct TieredBundle {
+  std::string arrayOfResources[6]; // Of the default tier
+  Texture* arrayOfFaces[6];
+  int tier;
+};
+
+// Snapshot of a texture, as reported to scripts
+struct TextureStats {
+  std::string resource;
+  int indexInBundle;
+  size_t residentBytes;
+  double decodeTime; // In milliseconds
+  double uploadTime;
+  unsigned int lastUsedFrame;
+  int evictionCount;
+};
 
 class Config;
 class Log;
 class Node;
-class Room;
 
 // This temporary macro is used to generate filenames
 #define mkstr(a) # a
@@ -51,10 +98,73 @@ class TextureManager {
   Config& config;
   Log& log;
   
-  std::vector<Texture*> _arrayOfActiveTextures;
   std::vector<Texture*> _arrayOfTextures;
+  std::vector<TextureCube*> _arrayOfCubes; // One per node with a bundle
+  std::vector<TieredBundle> _arrayOfBundles;
+  int _tier; // Size of the faces we want, in texels
+  bool _hasTier; // Selected at least once, otherwise the default
+  
+  // Resident textures, least recently used first. The index allows
+  // touching any of them in constant time, as they're requested or drawn.
+  // Faces of a cube map are listed once, by the first one uploaded.
+  std::list<Texture*> _residentTextures;
+  std::unordered_map<Texture*, std::list<Texture*>::iterator> _residentIndex;
+  std::unordered_set<Texture*> _pinnedTextures; // Never evicted
+  size_t _residentBytes;
+  
+  // Textures flow from the decode queue (workers) to the upload queue,
+  // which is drained by the main thread since it owns the GL context.
+  // The prefetch queue is only serviced when there's nothing else to decode.
+  // Faces of a bundle are read in one go, then inflated and scaled down in
+  // parallel through the finish queue, which always comes first.
+  // Low resolution previews of the current node are drawn until the full
+  // textures are uploaded.
+  SDL_cond* _condition;
+  SDL_mutex* _mutex;
+  std::vector<SDL_Thread*> _arrayOfWorkers;
+  std::deque<Texture*> _decodeQueue;
+  std::deque<Texture*> _finishQueue;
+  std::deque<Texture*> _prefetchQueue;
+  std::deque<Texture*> _previewQueue; // Always uploaded in full
+  std::deque<Texture*> _uploadQueue;
+  std::unordered_map<Texture*, int> _pendingTextures;
+  std::unordered_set<Texture*> _prefetchedTextures;
+  
+  // Bitmaps of images, buttons and cursors, shared by file name. Only used
+  // from the main thread.
+  std::unordered_map<std::string, Texture*> _imageCache;
+  std::unordered_map<Texture*, int> _imageReferences;
+  unsigned int _imageHits;
+  unsigned int _imageMisses;
+  std::unordered_map<std::string, ImageSize> _imageSizes;
+  bool _hasImageSizes; // Read from disk
+  bool _isImageSizesDirty;
+  
+  bool _isRunning;
+  unsigned int _prefetchHits;
+  unsigned int _prefetchMisses;
+  
+  // Time from a switch until every texture of the new node is uploaded
+  bool _isSwitching;
+  Uint64 _switchStart;
+  double _switchLatency;
+  
+  unsigned int _frame;
   
-  Room* _roomToPreload;
+  void _complete(Texture* target);
+  bool _decode();
+  void _evict();
+  void _finish(Texture* target);
+  static bool _isLarger(const TextureStats& stats,
+                        const TextureStats& otherStats);
+  void _loadImageSizes();
+  void _retier();
+  static int _runThread(void *ptr);
+  void _saveImageSizes();
+  std::string _tierPath(const std::string& ofResource, int tier);
+  void _touch(Texture* target);
+  static Texture* _unitOf(Texture* target); // As listed when resident
+  static size_t _unitBytes(Texture* unit);
   
   TextureManager();
   TextureManager(TextureManager const&);
@@ -67,16 +177,43 @@ public:
     return textureManager;
   }
   
+  // Returns the texture shared by every image using the file, which must be
+  // released when no longer needed
+  Texture* acquireImage(const std::string& fromFileName);
   void appendTextureToBundle(const char* nameOfBundle, Texture* textureToAppend);
   void createBundle(const char* nameOfBundle);
+  unsigned int imageHits();
+  unsigned int imageMisses();
+  size_t imageSavedBytes(); // Video memory not duplicated right now
+  // Size of an image without decoding it, from the header or the sizes
+  // remembered from previous sessions
+  bool imageSize(Texture* ofImage, int& width, int& height);
   int itemsInBundle(const char* nameOfBundle);
-  void flush();
+  void flush(Node* currentNode);
+  unsigned int frame(); // Number of updates so far
   void init();
+  void prefetchLinks(Node* fromNode);
+  unsigned int prefetchHits();
+  unsigned int prefetchMisses();
   void registerTexture(Texture* target);
+  void releaseImage(Texture* target);
   void requestBundle(Node* forNode);
+  void queueTexture(Texture* target);
   void requestTexture(Texture* target);
-  void setRoomToPreload(Room* theRoom);
-  bool updatePreloader();
+  size_t residentBytes();
+  // Chooses the tier of the faces from the size of the display, the field of
+  // view and the memory budget. Nodes other than the current one switch
+  // right away, the current one once we leave it.
+  void selectTier(int width, int height);
+  double switchLatency(); // Of the last switch, in milliseconds
+  // Every texture with a resource, largest first
+  void textureStats(std::vector<TextureStats>& arrayOfStats);
+  void terminate();
+  int tier();
+  // Moves a resident texture to the most recently used end, in constant
+  // time. Called as textures are drawn.
+  void touchTexture(Texture* target);
+  void update();
 };
   
 }
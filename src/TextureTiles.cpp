@@ -0,0 +1,379 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "CameraManager.h"
+#include "Config.h"
+#include "Node.h"
+#include "RenderManager.h"
+#include "Spot.h"
+#include "Texture.h"
+#include "TextureCompressor.h"
+#include "TextureTiles.h"
+#include "TextureUploader.h"
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+#define kTilesPerRow (kTilePageSize / kTileSize)
+#define kTilesPerPage (kTilesPerRow * kTilesPerRow)
+
+typedef struct {
+  Texture* texture;
+  int index;
+  double angle; // From the center of the view
+} TileRequest;
+
+// Point of a face of the cube, from its coordinates in the bitmap. Matches
+// the faces drawn by RenderManager.
+static void FacePoint(int face, float u, float v, float* point) {
+  float a = 2.0f * u - 1.0f;
+  float b = 2.0f * v - 1.0f;
+
+  float x = 0.0f, y = 0.0f, z = 0.0f;
+  switch (face) {
+    case kNorth:
+      x = a;
+      y = -b;
+      z = -1.0f;
+      break;
+    case kEast:
+      x = 1.0f;
+      y = -b;
+      z = a;
+      break;
+    case kSouth:
+      x = -a;
+      y = -b;
+      z = 1.0f;
+      break;
+    case kWest:
+      x = -1.0f;
+      y = -b;
+      z = -a;
+      break;
+    case kUp:
+      x = a;
+      y = 1.0f;
+      z = -b;
+      break;
+    case kDown:
+      x = a;
+      y = -1.0f;
+      z = b;
+      break;
+  }
+
+  point[0] = x;
+  point[1] = y;
+  point[2] = z;
+}
+
+static bool IsCloser(const TileRequest& first, const TileRequest& second) {
+  return first.angle < second.angle;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Constructor
+////////////////////////////////////////////////////////////
+
+TextureTiles::TextureTiles() :
+config(Config::instance())
+{
+  _numOfTiles = 0;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Gets
+////////////////////////////////////////////////////////////
+
+int TextureTiles::numPages() {
+  int pages = 0;
+  for (size_t i = 0; i < _arrayOfPages.size(); i++) {
+    if (_arrayOfPages[i].ident)
+      pages++;
+  }
+  return pages;
+}
+
+int TextureTiles::numTiles() {
+  return _numOfTiles;
+}
+
+size_t TextureTiles::residentBytes() {
+  size_t bytes = 0;
+  for (size_t i = 0; i < _arrayOfPages.size(); i++) {
+    if (_arrayOfPages[i].ident)
+      bytes += TextureCompressor::levelSize(_arrayOfPages[i].format,
+                                            kTilePageSize, kTilePageSize);
+  }
+  return bytes;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - State changes
+////////////////////////////////////////////////////////////
+
+void TextureTiles::draw(Texture* face) {
+  std::unordered_map<Texture*, std::vector<int> >::iterator it;
+  it = _residentTiles.find(face);
+  if (it == _residentTiles.end())
+    return;
+
+  // One draw per page, which is almost always a single one
+  const std::vector<int>& slots = it->second;
+  int tilesWide = face->width() / kTileSize;
+  float tileWidth = 1.0f / tilesWide;
+  float tileHeight = 1.0f / (face->height() / kTileSize);
+  float inset = 0.5f / kTilePageSize; // Keep clear of the neighbours
+
+  for (size_t page = 0; page < _arrayOfPages.size(); page++) {
+    std::vector<GLfloat> vertices;
+    std::vector<GLfloat> texCoords;
+
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (slots[i] < 0 || slots[i] / kTilesPerPage != static_cast<int>(page))
+        continue;
+
+      float u = (i % tilesWide) * tileWidth;
+      float v = (i / tilesWide) * tileHeight;
+      float corners[] = {u, v, u + tileWidth, v,
+                         u + tileWidth, v + tileHeight, u, v + tileHeight};
+
+      int slot = slots[i] % kTilesPerPage;
+      float s = static_cast<float>(slot % kTilesPerRow) / kTilesPerRow;
+      float t = static_cast<float>(slot / kTilesPerRow) / kTilesPerRow;
+      float size = 1.0f / kTilesPerRow;
+      float coords[] = {s + inset, t + inset, s + size - inset, t + inset,
+                        s + size - inset, t + size - inset,
+                        s + inset, t + size - inset};
+
+      for (int j = 0; j < 8; j += 2) {
+        GLfloat point[3];
+        FacePoint(face->indexInBundle(), corners[j], corners[j + 1], point);
+        vertices.insert(vertices.end(), point, point + 3);
+      }
+      texCoords.insert(texCoords.end(), coords, coords + 8);
+    }
+
+    if (!vertices.empty()) {
+      glBindTexture(GL_TEXTURE_2D, _arrayOfPages[page].ident);
+      RenderManager::instance().drawQuads(&vertices[0], &texCoords[0],
+                                          static_cast<int>(vertices.size()) /
+                                          12);
+    }
+  }
+}
+
+void TextureTiles::terminate() {
+  for (size_t i = 0; i < _arrayOfPages.size(); i++) {
+    if (_arrayOfPages[i].ident)
+      glDeleteTextures(1, &_arrayOfPages[i].ident);
+  }
+  _arrayOfPages.clear();
+  _residentTiles.clear();
+  _numOfTiles = 0;
+}
+
+void TextureTiles::update(Node* node) {
+  std::vector<Texture*> arrayOfFaces;
+  if (config.texTiling && node->hasSpots()) {
+    node->beginIteratingSpots();
+    do {
+      Spot* spot = node->currentSpot();
+      if (spot->hasTexture() && spot->texture()->hasTiles())
+        arrayOfFaces.push_back(spot->texture());
+    } while (node->iterateSpots());
+  }
+
+  // Tiles of faces we left behind, or that were unloaded
+  std::vector<Texture*> arrayOfReleased;
+  std::unordered_map<Texture*, std::vector<int> >::iterator it;
+  for (it = _residentTiles.begin(); it != _residentTiles.end(); ++it) {
+    if (std::find(arrayOfFaces.begin(), arrayOfFaces.end(),
+                  it->first) == arrayOfFaces.end())
+      arrayOfReleased.push_back(it->first);
+  }
+  for (size_t i = 0; i < arrayOfReleased.size(); i++)
+    _releaseTiles(arrayOfReleased[i]);
+
+  if (arrayOfFaces.empty())
+    return;
+
+  // The view is a cone around the direction of the camera, wide enough to
+  // cover the corners of the screen
+  CameraManager& cameraManager = CameraManager::instance();
+  float* orientation = cameraManager.orientation();
+  float* position = cameraManager.position();
+  double view[3];
+  double length = 0.0;
+  for (int i = 0; i < 3; i++) {
+    view[i] = orientation[i] - position[i];
+    length += view[i] * view[i];
+  }
+  length = sqrt(length);
+  if (length < 1e-6)
+    return;
+
+  double aspect = config.displayHeight ?
+    static_cast<double>(config.displayWidth) / config.displayHeight : 1.0;
+  double halfHeight = tan(cameraManager.fieldOfView() * M_PI / 360.0);
+  double cone = atan(halfHeight * sqrt(1.0 + aspect * aspect));
+  double margin = kTileMargin * M_PI / 180.0;
+
+  std::vector<TileRequest> arrayOfRequests;
+  for (size_t f = 0; f < arrayOfFaces.size(); f++) {
+    Texture* face = arrayOfFaces[f];
+    int tilesWide = face->width() / kTileSize;
+    int tilesHigh = face->height() / kTileSize;
+
+    std::vector<int>& slots = _residentTiles[face];
+    if (slots.empty())
+      slots.assign(tilesWide * tilesHigh, -1);
+
+    // Measured from the center of the face, which is the worst case
+    double radius = atan(sqrt(2.0) / tilesWide);
+
+    for (int i = 0; i < tilesWide * tilesHigh; i++) {
+      GLfloat center[3];
+      FacePoint(face->indexInBundle(),
+                ((i % tilesWide) + 0.5f) / tilesWide,
+                ((i / tilesWide) + 0.5f) / tilesHigh, center);
+      double distance = sqrt(center[0] * center[0] + center[1] * center[1] +
+                             center[2] * center[2]);
+      double cosine = (view[0] * center[0] + view[1] * center[1] +
+                       view[2] * center[2]) / (length * distance);
+      double angle = acos(std::max(-1.0, std::min(1.0, cosine))) - radius;
+
+      if (slots[i] < 0 && angle < cone + margin) {
+        TileRequest request = {face, i, angle};
+        arrayOfRequests.push_back(request);
+      } else if (slots[i] >= 0 && angle > cone + margin * 2) {
+        _releaseSlot(slots[i]);
+        slots[i] = -1;
+      }
+    }
+  }
+
+  // Closest to the center first
+  std::sort(arrayOfRequests.begin(), arrayOfRequests.end(), IsCloser);
+  if (arrayOfRequests.size() > kTileUploadsPerFrame)
+    arrayOfRequests.resize(kTileUploadsPerFrame);
+
+  std::vector<GLubyte> tile;
+  for (size_t i = 0; i < arrayOfRequests.size(); i++) {
+    Texture* face = arrayOfRequests[i].texture;
+    GLint format = face->internalFormat();
+    GLsizei size = static_cast<GLsizei>(
+      TextureCompressor::levelSize(format, kTileSize, kTileSize));
+    tile.resize(size);
+    if (!face->copyTile(arrayOfRequests[i].index %
+                        (face->width() / kTileSize),
+                        arrayOfRequests[i].index /
+                        (face->width() / kTileSize), &tile[0]))
+      continue;
+
+    int slot = _acquireSlot(format);
+    int position = slot % kTilesPerPage;
+    glBindTexture(GL_TEXTURE_2D, _arrayOfPages[slot / kTilesPerPage].ident);
+    TextureUploader::instance().compressedTexSubImage2D(
+      0, (position % kTilesPerRow) * kTileSize,
+      (position / kTilesPerRow) * kTileSize, kTileSize, kTileSize,
+      format, size, &tile[0]);
+    _residentTiles[face][arrayOfRequests[i].index] = slot;
+  }
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Private methods
+////////////////////////////////////////////////////////////
+
+int TextureTiles::_acquireSlot(GLint format) {
+  for (size_t i = 0; i < _arrayOfPages.size(); i++) {
+    TilePage& page = _arrayOfPages[i];
+    if (page.ident && page.format == format && !page.freeSlots.empty()) {
+      int slot = page.freeSlots.back();
+      page.freeSlots.pop_back();
+      _numOfTiles++;
+      return static_cast<int>(i) * kTilesPerPage + slot;
+    }
+  }
+
+  // Reuse a released page if possible, so slots keep their numbers
+  size_t index = 0;
+  while (index < _arrayOfPages.size() && _arrayOfPages[index].ident)
+    index++;
+  if (index == _arrayOfPages.size())
+    _arrayOfPages.push_back(TilePage());
+
+  TilePage& page = _arrayOfPages[index];
+  page.format = format;
+  page.freeSlots.clear();
+  for (int i = kTilesPerPage - 1; i > 0; i--)
+    page.freeSlots.push_back(i);
+
+  glGenTextures(1, &page.ident);
+  glBindTexture(GL_TEXTURE_2D, page.ident);
+  glCompressedTexImage2D(GL_TEXTURE_2D, 0, format, kTilePageSize,
+                         kTilePageSize, 0,
+                         static_cast<GLsizei>(
+                           TextureCompressor::levelSize(format, kTilePageSize,
+                                                        kTilePageSize)),
+                         NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  _numOfTiles++;
+  return static_cast<int>(index) * kTilesPerPage; // First slot
+}
+
+void TextureTiles::_releaseSlot(int slot) {
+  TilePage& page = _arrayOfPages[slot / kTilesPerPage];
+  page.freeSlots.push_back(slot % kTilesPerPage);
+  _numOfTiles--;
+
+  if (static_cast<int>(page.freeSlots.size()) == kTilesPerPage) {
+    glDeleteTextures(1, &page.ident);
+    page.ident = 0;
+    page.freeSlots.clear();
+  }
+}
+
+void TextureTiles::_releaseTiles(Texture* ofTexture) {
+  std::unordered_map<Texture*, std::vector<int> >::iterator it;
+  it = _residentTiles.find(ofTexture);
+  if (it == _residentTiles.end())
+    return;
+
+  // Note the texture may be gone already, so it's never dereferenced
+  for (size_t i = 0; i < it->second.size(); i++) {
+    if (it->second[i] >= 0)
+      _releaseSlot(it->second[i]);
+  }
+  _residentTiles.erase(it);
+}
+
+}
@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+#ifndef DAGON_TEXTURETILES_H_
+#define DAGON_TEXTURETILES_H_
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <GL/glew.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+// Faces are split in tiles of this size
+#define kTileSize 256
+
+// Faces are uploaded down to this size, and tiles drawn over them. Smaller
+// faces aren't tiled.
+#define kTileBaseSize 512
+
+// Tiles share pages of this size, 64 tiles each
+#define kTilePageSize 2048
+
+// Tiles this close to the view, in degrees, are loaded ahead of panning.
+// They're released once twice as far.
+#define kTileMargin 10
+
+// Copying tiles is cheap, but we still spread them over a few frames
+#define kTileUploadsPerFrame 8
+
+class Config;
+class Node;
+class Texture;
+
+typedef struct {
+  GLuint ident; // Zero once released
+  GLint format;
+  std::vector<int> freeSlots;
+} TilePage;
+
+////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////
+
+// Keeps the faces of the current node at full resolution only where the
+// camera is looking. Faces are resident down to kTileBaseSize, and the tiles
+// around the view are copied from the bitmap that textures retain for this
+// purpose. Only compressed mipmap chains can be tiled, since those already
+// store every level. Only to be used from the thread owning the GL context.
+
+class TextureTiles {
+  Config& config;
+
+  std::vector<TilePage> _arrayOfPages;
+  // Slot of every tile of a face, or -1 when not resident. Slots are
+  // numbered across pages.
+  std::unordered_map<Texture*, std::vector<int> > _residentTiles;
+  int _numOfTiles;
+
+  int _acquireSlot(GLint format);
+  void _releaseSlot(int slot);
+  void _releaseTiles(Texture* ofTexture);
+
+  TextureTiles();
+  TextureTiles(const TextureTiles&);
+  void operator=(const TextureTiles&);
+  ~TextureTiles() {}
+
+public:
+  static TextureTiles& instance() {
+    static TextureTiles textureTiles;
+    return textureTiles;
+  }
+
+  // Gets
+  int numPages();
+  int numTiles();
+  size_t residentBytes();
+
+  // State changes
+  // Draws the resident tiles of a face over its base texture
+  void draw(Texture* face);
+  void terminate();
+  // Called once per frame, before drawing the node, to load the tiles that
+  // came into view and release the ones that left it
+  void update(Node* node);
+};
+
+}
+
+#endif // DAGON_TEXTURETILES_H_
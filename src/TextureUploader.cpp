@@ -0,0 +1,220 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include <SDL2/SDL_timer.h>
+
+#include "Language.h"
+#include "Log.h"
+#include "TextureUploader.h"
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+#define kFenceTimeout 1000000000 // One second, in nanoseconds
+
+////////////////////////////////////////////////////////////
+// Implementation - Constructor
+////////////////////////////////////////////////////////////
+
+TextureUploader::TextureUploader() :
+log(Log::instance())
+{
+  for (int i = 0; i < kPixelBuffers; i++) {
+    _buffers[i] = 0;
+    _fences[i] = 0;
+  }
+  _current = 0;
+  _isEnabled = false;
+  _bytes = 0;
+  _bytesLastFrame = 0;
+  _stall = 0;
+  _stallLastFrame = 0;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Destructor
+////////////////////////////////////////////////////////////
+
+TextureUploader::~TextureUploader() {
+  // The context is gone by now, terminate() takes care of GL objects
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Checks
+////////////////////////////////////////////////////////////
+
+bool TextureUploader::isEnabled() {
+  return _isEnabled;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Gets
+////////////////////////////////////////////////////////////
+
+size_t TextureUploader::bytesLastFrame() {
+  return _bytesLastFrame;
+}
+
+double TextureUploader::stallLastFrame() {
+  return (_stallLastFrame * 1000.0) / SDL_GetPerformanceFrequency();
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - State changes
+////////////////////////////////////////////////////////////
+
+void TextureUploader::compressedTexImage2D(GLenum target, GLint level,
+                                           GLenum internalFormat,
+                                           GLsizei width, GLsizei height,
+                                           GLsizei size, const GLvoid* data) {
+  bool isStaged = _stage(data, size);
+  glCompressedTexImage2D(target, level, internalFormat, width, height,
+                         0, size, isStaged ? NULL : data);
+  _finish(isStaged);
+}
+
+void TextureUploader::compressedTexSubImage2D(GLint level, GLint x, GLint y,
+                                              GLsizei width, GLsizei height,
+                                              GLenum format, GLsizei size,
+                                              const GLvoid* data) {
+  bool isStaged = _stage(data, size);
+  glCompressedTexSubImage2D(GL_TEXTURE_2D, level, x, y, width, height,
+                            format, size, isStaged ? NULL : data);
+  _finish(isStaged);
+}
+
+void TextureUploader::init() {
+  // Requires GL 2.1 or equivalent for PBO, plus fences and mapping ranges
+  bool hasBuffers = GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object;
+  bool hasSync = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+  bool hasMapping = GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range;
+
+  if (hasBuffers && hasSync && hasMapping) {
+    glGenBuffers(kPixelBuffers, _buffers);
+    _isEnabled = true;
+    log.info(kModTexture, "%s", kString10006);
+  } else {
+    log.warning(kModTexture, "%s", kString10007);
+  }
+}
+
+void TextureUploader::terminate() {
+  if (_isEnabled) {
+    for (int i = 0; i < kPixelBuffers; i++) {
+      if (_fences[i]) {
+        glDeleteSync(_fences[i]);
+        _fences[i] = 0;
+      }
+    }
+    glDeleteBuffers(kPixelBuffers, _buffers);
+    _isEnabled = false;
+  }
+}
+
+void TextureUploader::texImage2D(GLenum target, GLint level,
+                                 GLint internalFormat,
+                                 GLsizei width, GLsizei height,
+                                 GLenum format, GLenum type,
+                                 GLsizei size, const GLvoid* data) {
+  bool isStaged = _stage(data, size);
+  // Rows are tightly packed, which the staged size relies on too
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(target, level, internalFormat, width, height, 0,
+               format, type, isStaged ? NULL : data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  _finish(isStaged);
+}
+
+void TextureUploader::texSubImage2D(GLint level, GLint x, GLint y,
+                                    GLsizei width, GLsizei height,
+                                    GLenum format, GLenum type,
+                                    GLsizei size, const GLvoid* data) {
+  bool isStaged = _stage(data, size);
+  // Rows are tightly packed, which the staged size relies on too
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, level, x, y, width, height,
+                  format, type, isStaged ? NULL : data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  _finish(isStaged);
+}
+
+void TextureUploader::update() {
+  _bytesLastFrame = _bytes;
+  _stallLastFrame = _stall;
+  _bytes = 0;
+  _stall = 0;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Private methods
+////////////////////////////////////////////////////////////
+
+void TextureUploader::_finish(bool isStaged) {
+  if (isStaged) {
+    _fences[_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    _current = (_current + 1) % kPixelBuffers;
+  }
+}
+
+bool TextureUploader::_stage(const GLvoid* data, GLsizei size) {
+  _bytes += size;
+
+  if (!_isEnabled || !data || size < kMinPixelBufferUpload)
+    return false;
+
+  // Wait until the GPU is done with this buffer. Normally it already is,
+  // otherwise we're uploading faster than the driver can keep up.
+  GLsync fence = _fences[_current];
+  if (fence) {
+    if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      Uint64 startTime = SDL_GetPerformanceCounter();
+      glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, kFenceTimeout);
+      _stall += SDL_GetPerformanceCounter() - startTime;
+    }
+    glDeleteSync(fence);
+    _fences[_current] = 0;
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _buffers[_current]);
+
+  // Orphan the previous storage, then fill the new one
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  void* buffer = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                  GL_MAP_WRITE_BIT |
+                                  GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (!buffer) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return false;
+  }
+
+  memcpy(buffer, data, size);
+  if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE) {
+    // Contents were lost, rare but allowed by the spec
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return false;
+  }
+
+  return true;
+}
+
+}
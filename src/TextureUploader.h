@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+#ifndef DAGON_TEXTUREUPLOADER_H_
+#define DAGON_TEXTUREUPLOADER_H_
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <GL/glew.h>
+#include <SDL2/SDL_stdinc.h>
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+// Number of pixel buffers in the ring. Each one is reused once the GPU is
+// done reading from it, which we learn from its fence.
+#define kPixelBuffers 4
+
+// Smaller uploads aren't worth the extra copy
+#define kMinPixelBufferUpload 65536
+
+class Log;
+
+////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////
+
+// Uploads go through a ring of pixel buffer objects, so the driver can copy
+// to video memory asynchronously while we keep rendering. Falls back to
+// plain client memory uploads without PBO and sync support. These must be
+// called from the thread owning the GL context, and the texture must be
+// bound. Uncompressed rows must be tightly packed, whatever their length.
+// The data can be freed as soon as they return. Targets are either
+// GL_TEXTURE_2D or a face of a cube map.
+
+class TextureUploader {
+  Log& log;
+
+  GLuint _buffers[kPixelBuffers];
+  GLsync _fences[kPixelBuffers];
+  int _current;
+  bool _isEnabled;
+
+  // Stats of the frame in progress and the last complete one
+  size_t _bytes;
+  size_t _bytesLastFrame;
+  Uint64 _stall;
+  Uint64 _stallLastFrame;
+
+  void _finish(bool isStaged);
+  bool _stage(const GLvoid* data, GLsizei size);
+
+  TextureUploader();
+  TextureUploader(const TextureUploader&);
+  void operator=(const TextureUploader&);
+  ~TextureUploader();
+
+public:
+  static TextureUploader& instance() {
+    static TextureUploader textureUploader;
+    return textureUploader;
+  }
+
+  // Checks
+  bool isEnabled();
+
+  // Gets
+  size_t bytesLastFrame();
+  double stallLastFrame(); // In milliseconds
+
+  // State changes
+  void compressedTexImage2D(GLenum target, GLint level, GLenum internalFormat,
+                            GLsizei width, GLsizei height,
+                            GLsizei size, const GLvoid* data);
+  void compressedTexSubImage2D(GLint level, GLint x, GLint y,
+                               GLsizei width, GLsizei height, GLenum format,
+                               GLsizei size, const GLvoid* data);
+  void init();
+  void terminate();
+  void texImage2D(GLenum target, GLint level, GLint internalFormat,
+                  GLsizei width, GLsizei height, GLenum format, GLenum type,
+                  GLsizei size, const GLvoid* data);
+  void texSubImage2D(GLint level, GLint x, GLint y,
+                     GLsizei width, GLsizei height, GLenum format, GLenum type,
+                     GLsizei size, const GLvoid* data);
+  // Called once per frame to roll the stats
+  void update();
+};
+
+}
+
+#endif // DAGON_TEXTUREUPLOADER_H_
@@ -17,45 +17,70 @@
 
 #include <SDL2/SDL.h>
 
+#include "Platform.h"
+
+#include <sys/stat.h>
+
+#ifdef DAGON_WINDOWS
+#include <windows.h>
+#endif
+
+#include <algorithm>
+
+#include "Config.h"
 #include "Defines.h"
 #include "Language.h"
 #include "Log.h"
 #include "Video.h"
+#include "VideoConverter.h"
 
 #include <cstring>
 #include <cmath>
 
-// TODO: Use 1.1 API calls
-
 namespace dagon {
 
 ////////////////////////////////////////////////////////////
 // Definitions
 ////////////////////////////////////////////////////////////
 
-// FIXME: No need to include this lookup table here, should go in the manager
+// Header of the index cache, followed by the keyframes
+typedef struct {
+  char ident[4];
+  uint32_t version;
+  uint32_t numOfKeyframes;
+} DGIndexHeader;
+
+static const char IndexIdent[4] = {'D', 'G', 'K', 'I'};
+#define kIndexVersion 1
 
-struct DGLookUpTable{
-  int m_plY[256];
-  int m_plRV[256];
-  int m_plGV[256];
-  int m_plGU[256];
-  int m_plBU[256];
-};
+static size_t PlanesSize(int width, int height) {
+  return width * height + 2 * ((width / 2) * (height / 2));
+}
 
-static struct DGLookUpTable _lookUpTable;
+static void AllocatePlanes(DGPlanarFrame* frame, int width, int height) {
+  unsigned char* data = (unsigned char*)malloc(PlanesSize(width, height));
+  frame->width = width;
+  frame->height = height;
+  frame->planes[0] = data;
+  frame->planes[1] = data + width * height;
+  frame->planes[2] = frame->planes[1] + (width / 2) * (height / 2);
+}
 
 ////////////////////////////////////////////////////////////
 // Implementation - Constructor
 ////////////////////////////////////////////////////////////
 
 Video::Video() :
+config(Config::instance()),
 log(Log::instance())
 {
   this->setType(kObjectVideo);
   
+  _clockBase = 0;
+  _pauseTicks = 0;
+  _frameCount = 0;
   _handle = NULL;
-  _hasNewFrame = false;
+  _hasFailed = false;
   _hasResource = false;
   _isLoaded = false;
   _state = VideoInitial;
@@ -66,23 +91,37 @@ log(Log::instance())
   
   _theoraInfo = new DGTheoraInfo;
 
-  _theoraInfo->bos = 0;
   _theoraInfo->theora_p = 0;
+  _theoraInfo->td = NULL;
+  _theoraInfo->ts = NULL;
   _theoraInfo->videobuf_ready = 0;
   _theoraInfo->videobuf_granulepos -= 1;
   _theoraInfo->videobuf_time = 0;
   
-  _initConversionToRGB();
+  _isIndexed = false;
+  _isRunning = false;
+  _ringHead = 0;
+  _ringTail = 0;
+  _indexer = NULL;
+  _worker = NULL;
+  
+  _condition = SDL_CreateCond();
   _mutex = SDL_CreateMutex();
   if (!_mutex)
     log.error(kModVideo, "%s", kString18001);
 }
 
 Video::Video(bool autoplay, bool loopable, bool synced)  :
+config(Config::instance()),
 log(Log::instance())
 {
   this->setType(kObjectVideo);
   
+  _clockBase = 0;
+  _pauseTicks = 0;
+  _frameCount = 0;
+  _handle = NULL;
+  _hasFailed = false;
   _hasResource = false;
   _isLoaded = false;
   _state = VideoInitial;
@@ -93,13 +132,21 @@ log(Log::instance())
   
   _theoraInfo = new DGTheoraInfo;
   
-  _theoraInfo->bos = 0;
   _theoraInfo->theora_p = 0;
+  _theoraInfo->td = NULL;
+  _theoraInfo->ts = NULL;
   _theoraInfo->videobuf_ready = 0;
   _theoraInfo->videobuf_granulepos -= 1;
   _theoraInfo->videobuf_time = 0;
   
-  _initConversionToRGB();
+  _isIndexed = false;
+  _isRunning = false;
+  _ringHead = 0;
+  _ringTail = 0;
+  _indexer = NULL;
+  _worker = NULL;
+  
+  _condition = SDL_CreateCond();
   _mutex = SDL_CreateMutex();
   if (!_mutex)
     log.error(kModVideo, "%s", kString18001);
@@ -112,6 +159,7 @@ log(Log::instance())
 Video::~Video() {
   this->unload();
   delete _theoraInfo;
+  SDL_DestroyCond(_condition);
   SDL_DestroyMutex(_mutex);
 }
 
@@ -123,13 +171,12 @@ bool Video::doesAutoplay() {
   return _doesAutoplay;
 }
 
+bool Video::hasFailed() {
+  return _hasFailed;
+}
+
 bool Video::hasNewFrame() {
-  if (_hasNewFrame) {
-    _hasNewFrame = false;
-    return true;
-  }
-  
-  return false;
+  return _present();
 }
 
 bool Video::hasResource() {
@@ -157,15 +204,19 @@ bool Video::isSynced() {
 ////////////////////////////////////////////////////////////
 
 DGFrame* Video::currentFrame() {
-  if (SDL_LockMutex(_mutex) == 0) {
-	memcpy(_auxFrame.data, _currentFrame.data, (_theoraInfo->ti.width * _theoraInfo->ti.height) * 3);
-    SDL_UnlockMutex(_mutex);
-  } else {
-    log.error(kModVideo, "%s", kString18002);
-  }
+  DGPlanarFrame* frame = this->currentPlanes();
+  VideoConverter::convert(frame->planes[0], frame->width,
+                          frame->planes[1], frame->planes[2],
+                          frame->width / 2, _auxFrame.data,
+                          frame->width, frame->height);
   return &_auxFrame;
 }
 
+DGPlanarFrame* Video::currentPlanes() {
+  _present();
+  return &_presentedFrame()->planes;
+}
+
 const char* Video::resource() {
   return _resource;
 }
@@ -184,6 +235,7 @@ void Video::setLoopable(bool loopable) {
 
 void Video::setResource(const char* fromFileName) {
   strncpy(_resource, fromFileName, kMaxFileLength);
+  _hasFailed = false;
   _hasResource = true;
 }
 
@@ -210,14 +262,16 @@ void Video::load() {
     
     if (_handle == NULL) {
       log.error(kModVideo, "%s: %s", kString17007, _resource);
+      _hasFailed = true;
       SDL_UnlockMutex(_mutex);
       return;
     }
     
     ogg_sync_init(&_theoraInfo->oy);
     
-    theora_comment_init(&_theoraInfo->tc);
-    theora_info_init(&_theoraInfo->ti);
+    th_comment_init(&_theoraInfo->tc);
+    th_info_init(&_theoraInfo->ti);
+    _theoraInfo->ts = NULL;
     
     while (!stateFlag) {
       std::size_t ret = _bufferData(&_theoraInfo->oy);
@@ -239,7 +293,7 @@ void Video::load() {
         ogg_stream_packetout(&test, &_theoraInfo->op);
         
         if (!_theoraInfo->theora_p &&
-            theora_decode_header(&_theoraInfo->ti, &_theoraInfo->tc, &_theoraInfo->op) >= 0) {
+            th_decode_headerin(&_theoraInfo->ti, &_theoraInfo->tc, &_theoraInfo->ts, &_theoraInfo->op) >= 0) {
           memcpy(&_theoraInfo->to, &test, sizeof(test));
           _theoraInfo->theora_p = 1;
         } else {
@@ -253,14 +307,11 @@ void Video::load() {
       
       while (_theoraInfo->theora_p && (_theoraInfo->theora_p < 3) &&
              (result = ogg_stream_packetout(&_theoraInfo->to, &_theoraInfo->op))) {
-        if (result < 0) {
-          log.error(kModVideo, "%s", kString17008);
-		  SDL_UnlockMutex(_mutex);
-          return;
-        }
-        
-        if (theora_decode_header(&_theoraInfo->ti, &_theoraInfo->tc, &_theoraInfo->op)) {
+        // Any data packet here would be an error as well
+        if (result < 0 ||
+            th_decode_headerin(&_theoraInfo->ti, &_theoraInfo->tc, &_theoraInfo->ts, &_theoraInfo->op) <= 0) {
           log.error(kModVideo, "%s", kString17008);
+          _failLoad();
 		  SDL_UnlockMutex(_mutex);
           return;
         }
@@ -276,35 +327,76 @@ void Video::load() {
         std::size_t ret = _bufferData(&_theoraInfo->oy);
         if (ret == 0) {
           log.error(kModVideo, "%s", kString17009);
+          _failLoad();
 		  SDL_UnlockMutex(_mutex);
           return;
         }
       }
     }
     
-    if (_theoraInfo->theora_p) {
-      theora_decode_init(&_theoraInfo->td, &_theoraInfo->ti);
-    } else {
-      theora_info_clear(&_theoraInfo->ti);
-      theora_comment_clear(&_theoraInfo->tc);
+    // Nothing to decode, so no frames, rate or workers either
+    if (!_theoraInfo->theora_p) {
+      log.error(kModVideo, "%s: %s", kString17015, _resource);
+      _failLoad();
+      SDL_UnlockMutex(_mutex);
+      return;
+    }
+    
+    // Chroma is assumed to be subsampled in both directions from here on
+    if (_theoraInfo->ti.pixel_fmt != TH_PF_420) {
+      log.error(kModVideo, "%s: %s", kString17014, _resource);
+      _failLoad();
+      SDL_UnlockMutex(_mutex);
+      return;
     }
     
-    _currentFrame.width = _theoraInfo->ti.width;
-    _currentFrame.height = _theoraInfo->ti.height;
-    _currentFrame.depth = 24; // NOTE: We only support flat RGB for now
-    _currentFrame.data = (unsigned char*)malloc((_theoraInfo->ti.width * _theoraInfo->ti.height) * 3);
-
-	_auxFrame.width = _currentFrame.width;
-	_auxFrame.height = _currentFrame.height;
-	_auxFrame.depth = _currentFrame.depth;
-	_auxFrame.data = (unsigned char*)malloc((_theoraInfo->ti.width * _theoraInfo->ti.height) * 3);
+    _theoraInfo->td = th_decode_alloc(&_theoraInfo->ti, _theoraInfo->ts);
+    th_setup_free(_theoraInfo->ts);
+    _theoraInfo->ts = NULL;
+    
+    // Start without post-processing, as always, and raise it only while
+    // decoding leaves enough headroom
+    _postMaxLevel = 0;
+    th_decode_ctl(_theoraInfo->td, TH_DECCTL_GET_PPLEVEL_MAX,
+                  &_postMaxLevel, sizeof(_postMaxLevel));
+    _decodeTime = 0;
+    _postWasRaised = false;
+    _postRaiseDelay = kVideoPostSettle;
+    _setPostprocessing(0);
+    
+    // Frames are decoded whole, padding included, as they always were
+    int width = _theoraInfo->ti.frame_width;
+    int height = _theoraInfo->ti.frame_height;
+    for (int i = 0; i < kVideoRingSize; i++) {
+      AllocatePlanes(&_ring[i].planes, width, height);
+      _ring[i].time = 0;
+    }
+    
+    _auxFrame.width = width;
+    _auxFrame.height = height;
+    _auxFrame.depth = 24; // NOTE: We only support flat RGB for now
+    _auxFrame.data = (unsigned char*)malloc((width * height) * 3);
     
     while (ogg_sync_pageout(&_theoraInfo->oy, &_theoraInfo->og) > 0) {
       _queuePage(_theoraInfo, &_theoraInfo->og);
     }
     
     _frameDuration = (double)(1.0/((double)_theoraInfo->ti.fps_numerator / (double)_theoraInfo->ti.fps_denominator)) * 1000.0;
+    _skipPackets = 0;
+    _streamFrame = 0;
     _isLoaded = true;
+    
+    _isRunning = true;
+    _worker = SDL_CreateThread(_runWorker, "Video", (void*)this);
+    if (!_worker)
+      log.error(kModVideo, "%s:%s", kString18003, SDL_GetError());
+    
+    // Without an index, jumps simply fall back to reading through the file
+    if (!_isIndexed) {
+      _indexer = SDL_CreateThread(_runIndexer, "VideoIndex", (void*)this);
+      if (!_indexer)
+        log.error(kModVideo, "%s:%s", kString18003, SDL_GetError());
+    }
     SDL_UnlockMutex(_mutex);
   } else {
     log.error(kModVideo, "%s", kString18002);
@@ -313,15 +405,25 @@ void Video::load() {
 
 void Video::play() {
   if (SDL_LockMutex(_mutex) == 0) {
-    _state = VideoPlaying;
-    yuv_buffer yuv;
-    _prepareFrame();
-    theora_decode_YUVout(&_theoraInfo->td, &yuv);
-    _convertToRGB(yuv.y, yuv.y_stride,
-                  yuv.u, yuv.v, yuv.uv_stride,
-                  _currentFrame.data, _theoraInfo->ti.width, _theoraInfo->ti.height, _theoraInfo->ti.width);
+    if (_state == VideoPaused) {
+      // Frames decoded ahead are kept, and the clock carries on from where
+      // it was paused
+      _state = VideoPlaying;
+      _clockBase += SDL_GetTicks() - _pauseTicks;
+    } else {
+      _state = VideoPlaying;
+      
+      // Frames decoded ahead are dropped and the clock starts over from the
+      // first one, which is decoded right away so it can be drawn already
+      _frameCount = 0;
+      _targetFrame = 0;
+      _ringTail = _ringHead.load();
+      if (_prepareFrame())
+        _storeFrame();
+      _clockBase = SDL_GetTicks();
+    }
     
-    _lastTime = SDL_GetTicks();
+    SDL_CondSignal(_condition);
     SDL_UnlockMutex(_mutex);
   } else {
     log.error(kModVideo, "%s", kString18002);
@@ -330,8 +432,10 @@ void Video::play() {
 
 void Video::pause() {
   if (SDL_LockMutex(_mutex) == 0) {
-    if (_state == VideoPlaying)
+    if (_state == VideoPlaying) {
       _state = VideoPaused;
+      _pauseTicks = SDL_GetTicks();
+    }
     SDL_UnlockMutex(_mutex);
   } else {
     log.error(kModVideo, "%s", kString18002);
@@ -342,9 +446,7 @@ void Video::stop() {
   if (SDL_LockMutex(_mutex) == 0) {
     if (_state == VideoPlaying) {
       _state = VideoStopped;
-      // Rewind
-      fseek(_handle, (long)_theoraInfo->bos * 8, SEEK_SET);
-      ogg_stream_reset(&_theoraInfo->to);
+      _rewind();
     }
     SDL_UnlockMutex(_mutex);
   } else {
@@ -353,6 +455,27 @@ void Video::stop() {
 }
 
 void Video::unload() {
+  // The worker may be waiting for the lock, so it quits first
+  if (SDL_LockMutex(_mutex) == 0) {
+    _isRunning = false;
+    SDL_CondSignal(_condition);
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModVideo, "%s", kString18002);
+  }
+  
+  if (_indexer) {
+    int threadReturnValue;
+    SDL_WaitThread(_indexer, &threadReturnValue);
+    _indexer = NULL;
+  }
+  
+  if (_worker) {
+    int threadReturnValue;
+    SDL_WaitThread(_worker, &threadReturnValue);
+    _worker = NULL;
+  }
+  
   if (SDL_LockMutex(_mutex) == 0) {
     if (_isLoaded) {
       _isLoaded = false;
@@ -363,21 +486,22 @@ void Video::unload() {
       _theoraInfo->videobuf_time = 0;
       
       if (_theoraInfo->theora_p) {
-        // Rewind and reset
-        fseek(_handle, (long)_theoraInfo->bos * 8, SEEK_SET);
-        ogg_stream_reset(&_theoraInfo->to);
         ogg_stream_clear(&_theoraInfo->to);
-        theora_clear(&_theoraInfo->td);
-        theora_comment_clear(&_theoraInfo->tc);
-        theora_info_clear(&_theoraInfo->ti);
+        th_decode_free(_theoraInfo->td);
+        _theoraInfo->td = NULL;
+        th_comment_clear(&_theoraInfo->tc);
+        th_info_clear(&_theoraInfo->ti);
       }
       
       ogg_sync_clear(&_theoraInfo->oy);
       
       _theoraInfo->theora_p = 0;
       
-      free(_currentFrame.data);
-	  free(_auxFrame.data);
+      for (int i = 0; i < kVideoRingSize; i++)
+        free(_ring[i].planes.planes[0]);
+      _ringHead = 0;
+      _ringTail = 0;
+      free(_auxFrame.data);
       fclose(_handle);
     }
     SDL_UnlockMutex(_mutex);
@@ -386,39 +510,34 @@ void Video::unload() {
   }
 }
 
-void Video::update() {
-  if (SDL_LockMutex(_mutex) == 0) {
-    if (_state == VideoPlaying) {
-      double currentTime = SDL_GetTicks();
-      double duration = currentTime - _lastTime;
-      if (duration >= _frameDuration) {
-        yuv_buffer yuv;
-        
-        // TODO: Skip frames if required here?
-        int frames = (int)floor(duration / _frameDuration);
-        for (int i = 0; i < frames; i++)
-          _prepareFrame();
-        
-        theora_decode_YUVout(&_theoraInfo->td, &yuv);
-        _convertToRGB(yuv.y, yuv.y_stride,
-                      yuv.u, yuv.v, yuv.uv_stride,
-                      _currentFrame.data, _theoraInfo->ti.width, _theoraInfo->ti.height, _theoraInfo->ti.width);
-        
-        _lastTime = currentTime;
-        
-        _hasNewFrame = true;
-      }
-    }
-    SDL_UnlockMutex(_mutex);
-  } else {
-    log.error(kModVideo, "%s", kString18002);
-  }
-}
-
 ////////////////////////////////////////////////////////////
 // Implementation - Private methods
 ////////////////////////////////////////////////////////////
 
+// Must be called with the mutex locked
+void Video::_adjustPostprocessing(double decodeTime) {
+  if (!_decodeTime)
+    _decodeTime = decodeTime;
+  else
+    _decodeTime += (decodeTime - _decodeTime) / 8;
+  
+  if (++_postFrames < kVideoPostSettle)
+    return;
+  
+  if (_decodeTime > _frameDuration * kVideoPostHighWater && _postLevel > 0) {
+    // A raise that didn't hold is retried later each time
+    if (_postWasRaised && _postFrames < kVideoPostSettle * 2 &&
+        _postRaiseDelay < kVideoPostMaxDelay)
+      _postRaiseDelay *= 2;
+    _postWasRaised = false;
+    _setPostprocessing(_postLevel - 1);
+  } else if (_decodeTime < _frameDuration * kVideoPostLowWater &&
+             _postLevel < _postMaxLevel && _postFrames >= _postRaiseDelay) {
+    _postWasRaised = true;
+    _setPostprocessing(_postLevel + 1);
+  }
+}
+
 std::size_t Video::_bufferData(ogg_sync_state* oy) {
   char *buffer = ogg_sync_buffer(oy, VideoBuffer);
   std::size_t bytes = fread(buffer, 1, VideoBuffer, _handle);
@@ -428,120 +547,245 @@ std::size_t Video::_bufferData(ogg_sync_state* oy) {
   return(bytes);
 }
 
-// TODO: This method needs a massive overhaul. It's slow and colors aren't accurate.
-void Video::_convertToRGB(uint8_t* puc_y, int stride_y,
-                            uint8_t* puc_u, uint8_t* puc_v, int stride_uv,
-                            uint8_t* puc_out, int width_y, int height_y,
-                            unsigned int _stride_out) {
-  int x, y;
-  int stride_diff = 6 * _stride_out - 3 * width_y;
-  
-  if (height_y < 0) {
-    // We are flipping our output upside-down
-    height_y  = -height_y;
-    puc_y     += (height_y - 1) * stride_y ;
-    puc_u     += ((height_y >> 1) - 1) * stride_uv;
-    puc_v     += ((height_y >> 1) - 1) * stride_uv;
-    stride_y  = -stride_y;
-    stride_uv = -stride_uv;
-  }
+// Asynchronous method. Reads the file through a handle of its own, apart
+// from the decoder, and gives up once the video is unloaded.
+bool Video::_buildIndex(std::vector<DGKeyframe>& keyframes) {
+  FILE* fh = fopen(_resource, "rb");
+  if (!fh)
+    return false;
+  
+  ogg_sync_state oy;
+  ogg_stream_state os;
+  ogg_page og;
+  ogg_packet op;
+  ogg_sync_init(&oy);
+  ogg_stream_init(&os, _theoraInfo->to.serialno);
   
-  for (y = 0; y < height_y; y += 2) {
-    uint8_t* pY = puc_y;
-    uint8_t* pY1 = puc_y+stride_y;
-    uint8_t* pU = puc_u;
-    uint8_t* pV = puc_v;
-    uint8_t* pOut2 = puc_out + 3 * _stride_out;
+  int64_t frame = 0;
+  int64_t offset = 0; // Of the next page in the sync buffer
+  int64_t start = 0; // Page where the next packet begins
+  int64_t skip = 0; // Packets already out that began on that page
+  while (_isRunning) {
+    long bytes = ogg_sync_pageseek(&oy, &og);
+    if (bytes == 0) {
+      char* buffer = ogg_sync_buffer(&oy, VideoBuffer);
+      size_t read = fread(buffer, 1, VideoBuffer, fh);
+      if (!read)
+        break;
+      ogg_sync_wrote(&oy, read);
+      continue;
+    } else if (bytes < 0) {
+      offset -= bytes; // Skipped garbage
+      continue;
+    }
     
-    for (x = 0; x < width_y; x += 2) {
-      int R, G, B;
-      int Y;
-      unsigned int tmp;
+    int64_t page = offset;
+    offset += bytes;
+    if (ogg_page_serialno(&og) != _theoraInfo->to.serialno)
+      continue;
+    
+    // Otherwise the next packet started on an earlier page
+    if (!ogg_page_continued(&og)) {
+      start = page;
+      skip = 0;
+    }
+    
+    ogg_stream_pagein(&os, &og);
+    int result;
+    while ((result = ogg_stream_packetout(&os, &op)) != 0) {
+      if (result < 0)
+        continue;
       
-      R = _lookUpTable.m_plRV[*pU];
-      G = _lookUpTable.m_plGV[*pU];
-      pU++;
-      G += _lookUpTable.m_plGU[*pV];
-      B = _lookUpTable.m_plBU[*pV];
-      pV++;
-      Y = _lookUpTable.m_plY[*pY];
-      pY++;
-      DGPutComponent(puc_out, R+Y, 0);
-      DGPutComponent(puc_out, G+Y, 1);
-      DGPutComponent(puc_out, B+Y, 2);
-      Y = _lookUpTable.m_plY[*pY];
-      pY++;
-      DGPutComponent(puc_out, R+Y, 3);
-      DGPutComponent(puc_out, G+Y, 4);
-      DGPutComponent(puc_out, B+Y, 5);
-      Y = _lookUpTable.m_plY[*pY1];
-      pY1++;
-      DGPutComponent(pOut2, R+Y, 0);
-      DGPutComponent(pOut2, G+Y, 1);
-      DGPutComponent(pOut2, B+Y, 2);
-      Y = _lookUpTable.m_plY[*pY1];
-      pY1++;
-      DGPutComponent(pOut2, R+Y, 3);
-      DGPutComponent(pOut2, G+Y, 4);
-      DGPutComponent(pOut2, B+Y, 5);
-      puc_out += 6;
-      pOut2 += 6;
+      int type = th_packet_iskeyframe(&op);
+      if (type == 1) {
+        DGKeyframe keyframe = {frame, start, skip};
+        keyframes.push_back(keyframe);
+      }
+      if (type >= 0)
+        frame++;
+      
+      // Any packet after this one begins on the current page
+      if (start == page) {
+        skip++;
+      } else {
+        start = page;
+        skip = 0;
+      }
+    }
+  }
+  
+  ogg_stream_clear(&os);
+  ogg_sync_clear(&oy);
+  fclose(fh);
+  
+  return _isRunning && !keyframes.empty();
+}
+
+// Must be called with the mutex locked
+void Video::_catchUp() {
+  if (_frameCount < _targetFrame)
+    return; // Already on it
+  
+  unsigned int due = static_cast<unsigned int>((SDL_GetTicks() - _clockBase) /
+                                               _frameDuration);
+  if (due < _frameCount + kVideoLateFrames)
+    return;
+  
+  // Frames up to the one due are decoded, but only for the sake of the ones
+  // that follow. Up to the last keyframe, not even that.
+  _targetFrame = due;
+  const DGKeyframe* keyframe = _findKeyframe(_streamFrame + due - _frameCount);
+  if (keyframe && keyframe->frame > _streamFrame) {
+    _frameCount += static_cast<unsigned int>(keyframe->frame - _streamFrame);
+    _seek(*keyframe);
+  }
+}
+
+// Must be called with the mutex locked. Nothing is tried again until the
+// resource is set anew.
+void Video::_failLoad() {
+  th_setup_free(_theoraInfo->ts);
+  _theoraInfo->ts = NULL;
+  if (_theoraInfo->theora_p)
+    ogg_stream_clear(&_theoraInfo->to);
+  th_comment_clear(&_theoraInfo->tc);
+  th_info_clear(&_theoraInfo->ti);
+  ogg_sync_clear(&_theoraInfo->oy);
+  _theoraInfo->theora_p = 0;
+  fclose(_handle);
+  _handle = NULL;
+  _hasFailed = true;
+}
+
+// Asynchronous method
+bool Video::_decode() {
+  if (SDL_LockMutex(_mutex) == 0) {
+    if (!_isRunning) {
+      SDL_UnlockMutex(_mutex);
+      return false;
     }
     
-    puc_y   += 2 * stride_y;
-    puc_u   += stride_uv;
-    puc_v   += stride_uv;
-    puc_out += stride_diff;
+    // One slot is always left to the frame on screen
+    unsigned int queued = _ringHead.load(std::memory_order_relaxed) -
+                          _ringTail.load(std::memory_order_acquire);
+    if (_state == VideoPlaying && queued + 1 < kVideoRingSize) {
+      _catchUp();
+      if (_prepareFrame()) {
+        if (_frameCount < _targetFrame)
+          _frameCount++; // Late, so never shown
+        else
+          _storeFrame();
+      }
+    } else {
+      // Presenting a frame doesn't take the lock, so it may not wake us up
+      SDL_CondWaitTimeout(_condition, _mutex, kVideoWorkerWait);
+    }
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModVideo, "%s", kString18002);
+    return false;
   }
+  
+  return true;
+}
+
+const DGKeyframe* Video::_findKeyframe(int64_t frame) {
+  std::vector<DGKeyframe>::iterator it =
+    std::upper_bound(_arrayOfKeyframes.begin(), _arrayOfKeyframes.end(), frame,
+                     [](int64_t value, const DGKeyframe& keyframe) {
+                       return value < keyframe.frame;
+                     });
+  if (it == _arrayOfKeyframes.begin())
+    return NULL;
+  return &*(it - 1);
 }
+
+// Asynchronous method
+void Video::_index() {
+  std::vector<DGKeyframe> keyframes;
+  std::string indexPath = _indexPath();
+  if (!_readIndex(indexPath, keyframes)) {
+    keyframes.clear();
+    if (!_buildIndex(keyframes))
+      return;
+    if (!indexPath.empty())
+      _writeIndex(indexPath, keyframes);
+  }
   
-void Video::_initConversionToRGB() {
-  // Manually tweaked alues from http://www.fourcc.org/fccyvrgb.php
-  static const int prec = 8;
-  static const int CoY	= (int)(1.169 * (1 << prec) + 0.5);
-  static const int CoRV	= (int)(2.042 * (1 << prec) + 0.5);
-  static const int CoGU	= (int)(0.841 * (1 << prec) + 0.5);
-  static const int CoGV	= (int)(0.393 * (1 << prec) + 0.5);
-  static const int CoBU	= (int)(1.628 * (1 << prec) + 0.5);
+  if (SDL_LockMutex(_mutex) == 0) {
+    _arrayOfKeyframes.swap(keyframes);
+    _isIndexed = true;
+    SDL_UnlockMutex(_mutex);
+  } else {
+    log.error(kModVideo, "%s", kString18002);
+  }
+}
+
+// Indexes are kept with the texture cache, as the resources may well be
+// read-only. Named after the file, its size and modification time.
+std::string Video::_indexPath() {
+  struct stat info;
+  if (stat(_resource, &info) != 0)
+    return "";
+  
+  char stamp[64];
+  snprintf(stamp, sizeof(stamp), "|%lld|%lld",
+           static_cast<long long>(info.st_mtime),
+           static_cast<long long>(info.st_size));
+  std::string key = std::string(_resource) + stamp;
+  
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); i++) {
+    hash ^= static_cast<unsigned char>(key[i]);
+    hash *= 1099511628211ULL;
+  }
   
-  for (int i = 0; i < 256; ++i) {
-		_lookUpTable.m_plGU[i] = -CoGU * (i - 128);
-		_lookUpTable.m_plGV[i] = -CoGV * (i - 128);
-		_lookUpTable.m_plBU[i] = CoBU * (i - 128);
-		_lookUpTable.m_plRV[i] = CoRV * (i - 128);
-		_lookUpTable.m_plY[i]  = CoY * (i - 16) + (prec / 2);
-	}
+  char fileName[32];
+  snprintf(fileName, sizeof(fileName), "%016llx.idx",
+           static_cast<unsigned long long>(hash));
+  return config.path(kPathUserData, std::string(kDefTexCachePath) + fileName,
+                     kObjectGeneric);
+}
+
+DGTimedFrame* Video::_presentedFrame() {
+  unsigned int tail = _ringTail.load(std::memory_order_relaxed);
+  return &_ring[(tail - 1) % kVideoRingSize];
 }
 
 int Video::_prepareFrame() {
   while (_state == VideoPlaying) {
     while (_theoraInfo->theora_p && !_theoraInfo->videobuf_ready) {
       if (ogg_stream_packetout(&_theoraInfo->to, &_theoraInfo->op) > 0) {
-        theora_decode_packetin(&_theoraInfo->td, &_theoraInfo->op);
-        _theoraInfo->videobuf_granulepos = _theoraInfo->td.granulepos;
-        _theoraInfo->videobuf_time = theora_granule_time(&_theoraInfo->td, _theoraInfo->videobuf_granulepos);
-        _theoraInfo->videobuf_ready = 1;
+        // Packets on the same page before the keyframe we jumped to
+        if (_skipPackets > 0) {
+          _skipPackets--;
+          continue;
+        }
+        
+        // Only seen when rewinding without an index
+        if (th_packet_isheader(&_theoraInfo->op))
+          continue;
         
-        if (!_theoraInfo->bos) {
-          _theoraInfo->bos = _theoraInfo->td.granulepos;
+        Uint64 startTime = SDL_GetPerformanceCounter();
+        int result = th_decode_packetin(_theoraInfo->td, &_theoraInfo->op,
+                                        &_theoraInfo->videobuf_granulepos);
+        // Dropped frames cost nothing, so they don't count
+        if (result == 0) {
+          _adjustPostprocessing(((SDL_GetPerformanceCounter() - startTime) *
+                                 1000.0) / SDL_GetPerformanceFrequency());
         }
+        _theoraInfo->videobuf_time = th_granule_time(_theoraInfo->td, _theoraInfo->videobuf_granulepos);
+        _theoraInfo->videobuf_ready = 1;
+        _streamFrame++;
       } else
         break;
     }
     
     if (!_theoraInfo->videobuf_ready && feof(_handle)) {
-      if (_isLoopable) {
-        // This is the begin of stream (granule position) * 8 bits (in bytes)
-        fseek(_handle, (long)_theoraInfo->bos * 8, SEEK_SET);
-        ogg_stream_reset(&_theoraInfo->to);
-      }
-      else {
+      if (!_isLoopable)
         _state = VideoStopped;
-        
-        // Rewind
-        fseek(_handle, (long)_theoraInfo->bos * 8, SEEK_SET);
-        ogg_stream_reset(&_theoraInfo->to);
-      }
+      _rewind();
       
       break;
     }
@@ -563,10 +807,177 @@ int Video::_prepareFrame() {
   return 0;
 }
 
+bool Video::_present() {
+  if (_state == VideoPaused)
+    return false;
+  
+  double time = SDL_GetTicks() - _clockBase;
+  unsigned int head = _ringHead.load(std::memory_order_acquire);
+  unsigned int tail = _ringTail.load(std::memory_order_relaxed);
+  unsigned int due = tail;
+  while (due != head && _ring[due % kVideoRingSize].time <= time)
+    due++;
+  
+  if (due == tail)
+    return false;
+  
+  // Frames overtaken by the clock are dropped along with the previous one
+  _ringTail.store(due, std::memory_order_release);
+  SDL_CondSignal(_condition);
+  return true;
+}
+
 int Video::_queuePage(DGTheoraInfo* theoraInfo, ogg_page *page) {
   if (theoraInfo->theora_p) ogg_stream_pagein(&theoraInfo->to, page);
   
   return 0;
 }
+
+bool Video::_readIndex(const std::string& fromFile,
+                       std::vector<DGKeyframe>& keyframes) {
+  FILE* fh = fopen(fromFile.c_str(), "rb");
+  if (!fh)
+    return false;
+  
+  // The count is only trusted as far as the index and the video go
+  struct stat info;
+  long size = -1;
+  if (fseek(fh, 0, SEEK_END) == 0) {
+    size = ftell(fh);
+    rewind(fh);
+  }
+  if (size < static_cast<long>(sizeof(DGIndexHeader)) ||
+      stat(_resource, &info) != 0) {
+    fclose(fh);
+    return false;
+  }
+  
+  DGIndexHeader header;
+  size_t maxKeyframes = (size - sizeof(header)) / sizeof(DGKeyframe);
+  bool isRead = fread(&header, sizeof(header), 1, fh) == 1 &&
+                !memcmp(header.ident, IndexIdent, sizeof(IndexIdent)) &&
+                header.version == kIndexVersion && header.numOfKeyframes &&
+                header.numOfKeyframes <= maxKeyframes;
+  if (isRead) {
+    keyframes.resize(header.numOfKeyframes);
+    isRead = fread(&keyframes[0], sizeof(DGKeyframe), keyframes.size(),
+                   fh) == keyframes.size();
+  }
+  fclose(fh);
+  
+  // Seeks land on these offsets, and lookups expect them in order
+  int64_t videoSize = static_cast<int64_t>(info.st_size);
+  for (size_t i = 0; isRead && i < keyframes.size(); i++) {
+    const DGKeyframe& keyframe = keyframes[i];
+    if (keyframe.frame < 0 || keyframe.offset < 0 ||
+        keyframe.offset >= videoSize || keyframe.skip < 0 ||
+        (i && keyframe.frame <= keyframes[i - 1].frame))
+      isRead = false;
+  }
+  
+  return isRead;
+}
+
+// Must be called with the mutex locked
+void Video::_rewind() {
+  if (!_arrayOfKeyframes.empty()) {
+    _seek(_arrayOfKeyframes.front());
+  } else {
+    // Headers are skipped while decoding, so the start of the file will do
+    DGKeyframe start = {0, 0, 0};
+    _seek(start);
+  }
+}
+
+int Video::_runIndexer(void *ptr) {
+  static_cast<Video*>(ptr)->_index();
+  return 0;
+}
+
+int Video::_runWorker(void *ptr) {
+  Video* video = static_cast<Video*>(ptr);
+  while (video->_decode()) {}
+  return 0;
+}
+
+// Must be called with the mutex locked
+void Video::_seek(const DGKeyframe& keyframe) {
+  fseek(_handle, static_cast<long>(keyframe.offset), SEEK_SET);
+  ogg_sync_reset(&_theoraInfo->oy);
+  ogg_stream_reset(&_theoraInfo->to);
+  _theoraInfo->videobuf_ready = 0;
+  _skipPackets = keyframe.skip;
+  _streamFrame = keyframe.frame;
+}
+
+// Must be called with the mutex locked
+void Video::_setPostprocessing(int level) {
+  th_decode_ctl(_theoraInfo->td, TH_DECCTL_SET_PPLEVEL, &level, sizeof(level));
+  _postFrames = 0;
+  _postLevel = level;
+}
+
+void Video::_storeFrame() {
+  th_ycbcr_buffer yuv;
+  th_decode_ycbcr_out(_theoraInfo->td, yuv);
+  
+  unsigned int head = _ringHead.load(std::memory_order_relaxed);
+  DGTimedFrame* frame = &_ring[head % kVideoRingSize];
+  DGPlanarFrame* planes = &frame->planes;
+  int chromaWidth = planes->width / 2;
+  for (int i = 0; i < planes->height; i++) {
+    memcpy(planes->planes[0] + i * planes->width,
+           yuv[0].data + i * yuv[0].stride, planes->width);
+  }
+  for (int i = 0; i < planes->height / 2; i++) {
+    memcpy(planes->planes[1] + i * chromaWidth,
+           yuv[1].data + i * yuv[1].stride, chromaWidth);
+    memcpy(planes->planes[2] + i * chromaWidth,
+           yuv[2].data + i * yuv[2].stride, chromaWidth);
+  }
+  frame->time = _frameCount++ * _frameDuration;
+  
+  // Published once written
+  _ringHead.store(head + 1, std::memory_order_release);
+}
+
+// Asynchronous method. Written aside and renamed, so a partial index is never
+// picked up.
+void Video::_writeIndex(const std::string& toFile,
+                        const std::vector<DGKeyframe>& keyframes) {
+  std::string directory = config.path(kPathUserData, kDefTexCachePath,
+                                      kObjectGeneric);
+#ifdef DAGON_WINDOWS
+  CreateDirectoryA(directory.c_str(), NULL);
+#else
+  mkdir(directory.c_str(), 0755);
+#endif
+  
+  DGIndexHeader header;
+  memcpy(header.ident, IndexIdent, sizeof(IndexIdent));
+  header.version = kIndexVersion;
+  header.numOfKeyframes = static_cast<uint32_t>(keyframes.size());
+  
+  std::string partialFile = toFile + ".part";
+  FILE* fh = fopen(partialFile.c_str(), "wb");
+  bool isWritten = (fh != NULL);
+  if (fh) {
+    isWritten = fwrite(&header, sizeof(header), 1, fh) == 1 &&
+                fwrite(&keyframes[0], sizeof(DGKeyframe), keyframes.size(),
+                       fh) == keyframes.size();
+    if (fclose(fh) != 0)
+      isWritten = false;
+  }
+  
+  if (isWritten) {
+    remove(toFile.c_str());
+    isWritten = (rename(partialFile.c_str(), toFile.c_str()) == 0);
+  }
+  
+  if (!isWritten) {
+    remove(partialFile.c_str());
+    log.warning(kModVideo, "%s: %s", kString17013, toFile.c_str());
+  }
+}
   
 }
@@ -19,7 +19,14 @@
 ////////////////////////////////////////////////////////////
 
 #include <SDL2/SDL_mutex.h>
-#include <theora/theora.h>
+#include <SDL2/SDL_thread.h>
+#include <theora/theoradec.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include "Object.h"
 
@@ -43,16 +50,37 @@ typedef struct {
   unsigned char* data;
 } DGFrame;
 
+// Frames as decoded, 4:2:0 without padding. Chroma planes are half as wide
+// and high as luma.
+typedef struct {
+  int width;
+  int height;
+  unsigned char* planes[3]; // Y, U and V, all in the same allocation
+} DGPlanarFrame;
+
+// Decoded frames wait in a ring until due
+typedef struct {
+  DGPlanarFrame planes;
+  double time; // In milliseconds since the video was played
+} DGTimedFrame;
+
+// Where decoding can start over. Written as is to the index cache.
+typedef struct {
+  int64_t frame;
+  int64_t offset; // Of the page where the keyframe begins
+  int64_t skip; // Packets beginning on that page before the keyframe
+} DGKeyframe;
+
 typedef struct {
   ogg_sync_state oy;
   ogg_page og;
   ogg_stream_state to;
-  theora_info ti;
-  theora_comment tc;
-  theora_state td;
+  th_info ti;
+  th_comment tc;
+  th_setup_info* ts; // Only until the decoder is allocated
+  th_dec_ctx* td;
   ogg_packet op;
   
-  ogg_int64_t bos;
   int long_option_index;
   int c;
   int theora_p;
@@ -63,51 +91,112 @@ typedef struct {
 
 #define VideoBuffer 4096
 
-#define DGPutComponent(p, v, i) \
-tmp = (unsigned int)(v); \
-if (tmp < 0x10000) \
-p[i] = tmp >> 8; \
-else \
-p[i] = (tmp >> 24) ^ 0xff;
+// Frames decoded ahead, plus the one being presented
+#define kVideoRingSize 4
+
+// Idle workers check again after this many milliseconds at most
+#define kVideoWorkerWait 5
+
+// Workers skip ahead once they fall this many frames behind the clock
+#define kVideoLateFrames 2
 
+// Post-processing is lowered once decoding takes this share of the frame
+// duration on average, and raised again below the second
+#define kVideoPostHighWater 0.75
+#define kVideoPostLowWater 0.4
+
+// Frames decoded between changes of post-processing. Raises that didn't
+// hold wait twice as long each time, up to the maximum.
+#define kVideoPostSettle 24
+#define kVideoPostMaxDelay 768
+
+class Config;
 class Log;
 
 ////////////////////////////////////////////////////////////
 // Interface
 ////////////////////////////////////////////////////////////
 
+// Threading: every video is decoded by its own worker, started on load, into
+// a ring of frames. The render thread presents them by moving the tail of the
+// ring, which hands the slots back to the worker, so frames are neither
+// copied nor locked on the way. The mutex guards the decoder, which state
+// changes share with the worker. Gets and state changes must be called from
+// the render thread. The keyframes of the file are indexed once, on a thread
+// of their own so that playback starts right away, and loops, rewinds and
+// late frames then jump straight to them.
+
 class Video : public Object {
+  Config& config;
   Log& log;
   
-  DGFrame _auxFrame;
-  DGFrame _currentFrame;
+  DGFrame _auxFrame; // Converted on request
+  DGTimedFrame _ring[kVideoRingSize];
+  std::atomic<unsigned int> _ringHead; // Frames published by the worker
+  std::atomic<unsigned int> _ringTail; // Presented so far, one is on screen
   DGTheoraInfo* _theoraInfo;
   
+  // Built by the first indexer, or read from the cache. Guarded by the mutex.
+  std::vector<DGKeyframe> _arrayOfKeyframes;
+  bool _isIndexed;
+  int64_t _skipPackets; // Left to drop after jumping to a keyframe
+  int64_t _streamFrame; // Next to decode, counted from the start of the file
+  unsigned int _targetFrame; // Earlier frames are decoded but never shown
+  
+  // Post-processing, adjusted by the worker to the time it takes to decode
+  double _decodeTime; // Average, in milliseconds
+  bool _postWasRaised;
+  int _postFrames; // Decoded since the last change
+  int _postLevel;
+  int _postMaxLevel;
+  int _postRaiseDelay;
+  
+  double _clockBase; // Ticks when the first frame was due
+  double _pauseTicks; // Ticks when last paused
   bool _doesAutoplay;
   double _frameDuration;
+  unsigned int _frameCount; // Decoded since the video was played
   FILE* _handle;
-  bool _hasNewFrame;
+  bool _hasFailed;
   bool _hasResource;
   bool _isLoaded;
   bool _isLoopable;
+  std::atomic<bool> _isRunning; // Worker is to keep going
   bool _isSynced;
-  double _lastTime;
-  int _state;
+  std::atomic<int> _state; // Written with the mutex locked, read without it
   
+  SDL_cond* _condition; // Wakes up the worker
   SDL_mutex* _mutex;
+  SDL_Thread* _indexer; // Quits along with the worker
+  SDL_Thread* _worker;
   
   // Eventually all file management will be handled by a DGResourceManager object
   char _resource[kMaxFileLength];
   
   // Private methods
+  void _adjustPostprocessing(double decodeTime);
   std::size_t _bufferData(ogg_sync_state* oy);
-  void _convertToRGB(uint8_t* puc_y, int stride_y,
-                     uint8_t* puc_u, uint8_t* puc_v, int stride_uv,
-                     uint8_t* puc_out, int width_y, int height_y,
-                     unsigned int _stride_out);
-  void _initConversionToRGB();
+  bool _buildIndex(std::vector<DGKeyframe>& keyframes);
+  void _catchUp(); // Jumps ahead when late, to the nearest keyframe if any
+  bool _decode(); // Returns false once the worker must quit
+  void _failLoad(); // Undoes a load that failed halfway
+  const DGKeyframe* _findKeyframe(int64_t frame); // Last one up to the frame
+  void _index();
+  std::string _indexPath();
+  DGTimedFrame* _presentedFrame();
   int _prepareFrame();
+  bool _present(); // Moves to the latest frame due, if any
   static int _queuePage(DGTheoraInfo* theoraInfo, ogg_page *page);
+  bool _readIndex(const std::string& fromFile,
+                  std::vector<DGKeyframe>& keyframes);
+  void _rewind();
+  static int _runIndexer(void *ptr);
+  static int _runWorker(void *ptr);
+  void _seek(const DGKeyframe& keyframe);
+  void _setPostprocessing(int level);
+  void _storeFrame(); // Publishes the frame, with the mutex locked
+  void _writeIndex(const std::string& toFile,
+                   const std::vector<DGKeyframe>& keyframes);
   
 public:
   Video();
@@ -117,7 +206,9 @@ public:
   // Checks
   
   bool doesAutoplay();
-  bool hasNewFrame();
+  // Refused or unreadable, so not loaded again until the resource is set
+  bool hasFailed();
+  bool hasNewFrame(); // Presents the latest frame due, if any
   bool hasResource();
   bool isLoaded();
   bool isLoopable();
@@ -126,7 +217,11 @@ public:
   
   // Gets
   
+  // Both present the latest frame due. Planes point straight into the ring
+  // and stay valid until the next call, the frame is converted to BGR on the
+  // CPU.
   DGFrame* currentFrame();
+  DGPlanarFrame* currentPlanes();
   const char* resource();
   
   // Sets
@@ -143,7 +238,6 @@ public:
   void pause();
   void stop();
   void unload();
-  void update();
 };
   
 }
@@ -0,0 +1,511 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <SDL2/SDL_cpuinfo.h>
+#include <SDL2/SDL_timer.h>
+
+#include <vector>
+
+#include "VideoConverter.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define DAGON_VIDEO_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DAGON_VIDEO_NEON
+#include <arm_neon.h>
+#endif
+
+// Lets GCC and Clang build the kernels without raising the requirements of
+// the whole engine. The CPU is checked before calling them.
+#if defined(__GNUC__)
+#define DAGON_TARGET_SSE2 __attribute__((target("sse2")))
+#define DAGON_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define DAGON_TARGET_SSE2
+#define DAGON_TARGET_AVX2
+#endif
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+// Manually tweaked values from http://www.fourcc.org/fccyvrgb.php, in 8-bit
+// fixed point. Luma is biased by 4 rather than half a unit. That's how
+// videos have always looked, so every kernel keeps it, and so does the
+// shader converting frames on the GPU.
+#define kCoY 299 // 1.169
+#define kCoBU 523 // 2.042
+#define kCoGU 101 // 0.393
+#define kCoGV 215 // 0.841
+#define kCoRV 417 // 1.628
+#define kLumaBias 4
+
+// Converts a pair of rows, returning the pixels done. The rest are left to
+// the scalar kernel.
+typedef int (*SpanKernel)(const unsigned char* y0, const unsigned char* y1,
+                          const unsigned char* u, const unsigned char* v,
+                          unsigned char* out0, unsigned char* out1,
+                          int width);
+
+static const char* KernelNames[kVideoNumKernels] = {
+  "scalar", "sse2", "avx2", "neon"
+};
+
+// Same as clamping value >> 8 to a byte, for the range of these sums.
+// Negative values wrap to the top and end up as zero.
+static inline unsigned char Clamp(int value) {
+  unsigned int bits = static_cast<unsigned int>(value);
+  if (bits < 0x10000)
+    return static_cast<unsigned char>(bits >> 8);
+  else
+    return static_cast<unsigned char>((bits >> 24) ^ 0xFF);
+}
+
+static inline void PutPixel(unsigned char* pixel, int luma,
+                            int b, int g, int r) {
+  pixel[0] = Clamp(luma + b);
+  pixel[1] = Clamp(luma + g);
+  pixel[2] = Clamp(luma + r);
+}
+
+static void ConvertScalar(const unsigned char* y0, const unsigned char* y1,
+                          const unsigned char* u, const unsigned char* v,
+                          unsigned char* out0, unsigned char* out1,
+                          int fromX, int toX) {
+  for (int x = fromX; x < toX; x += 2) {
+    int cu = u[x >> 1] - 128;
+    int cv = v[x >> 1] - 128;
+    int b = kCoBU * cu;
+    int g = -kCoGU * cu - kCoGV * cv;
+    int r = kCoRV * cv;
+
+    PutPixel(out0 + x * 3, kCoY * (y0[x] - 16) + kLumaBias, b, g, r);
+    PutPixel(out0 + x * 3 + 3, kCoY * (y0[x + 1] - 16) + kLumaBias, b, g, r);
+    PutPixel(out1 + x * 3, kCoY * (y1[x] - 16) + kLumaBias, b, g, r);
+    PutPixel(out1 + x * 3 + 3, kCoY * (y1[x + 1] - 16) + kLumaBias, b, g, r);
+  }
+}
+
+#ifdef DAGON_VIDEO_X86
+
+// Signed 16-bit lanes times a constant, widened to two registers of 32 bits
+DAGON_TARGET_SSE2
+static inline void MultiplySSE2(__m128i value, int factor, __m128i* result) {
+  __m128i constant = _mm_set1_epi16(static_cast<short>(factor));
+  __m128i low = _mm_mullo_epi16(value, constant);
+  __m128i high = _mm_mulhi_epi16(value, constant);
+  result[0] = _mm_unpacklo_epi16(low, high);
+  result[1] = _mm_unpackhi_epi16(low, high);
+}
+
+// Sixteen pixels of a channel, from the luma of each and the chroma of each
+// pair
+DAGON_TARGET_SSE2
+static inline __m128i ChannelSSE2(const __m128i* luma, const __m128i* chroma) {
+  __m128i sum[4];
+  for (int i = 0; i < 2; i++) {
+    sum[i * 2] = _mm_srai_epi32(_mm_add_epi32(luma[i * 2],
+      _mm_unpacklo_epi32(chroma[i], chroma[i])), 8);
+    sum[i * 2 + 1] = _mm_srai_epi32(_mm_add_epi32(luma[i * 2 + 1],
+      _mm_unpackhi_epi32(chroma[i], chroma[i])), 8);
+  }
+  return _mm_packus_epi16(_mm_packs_epi32(sum[0], sum[1]),
+                          _mm_packs_epi32(sum[2], sum[3]));
+}
+
+// Without byte shuffles, pixels are spread to 32 bits and squeezed back in
+// pairs. Each store spills two bytes past the last pixel.
+DAGON_TARGET_SSE2
+static inline void RowSSE2(const unsigned char* y, const __m128i* b,
+                           const __m128i* g, const __m128i* r,
+                           unsigned char* out) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y));
+  __m128i bias = _mm_set1_epi32(kLumaBias);
+  __m128i luma[4];
+  MultiplySSE2(_mm_sub_epi16(_mm_unpacklo_epi8(bytes, zero),
+                             _mm_set1_epi16(16)), kCoY, luma);
+  MultiplySSE2(_mm_sub_epi16(_mm_unpackhi_epi8(bytes, zero),
+                             _mm_set1_epi16(16)), kCoY, luma + 2);
+  for (int i = 0; i < 4; i++)
+    luma[i] = _mm_add_epi32(luma[i], bias);
+
+  __m128i blue = ChannelSSE2(luma, b);
+  __m128i green = ChannelSSE2(luma, g);
+  __m128i red = ChannelSSE2(luma, r);
+
+  __m128i blueGreen[] = {_mm_unpacklo_epi8(blue, green),
+                         _mm_unpackhi_epi8(blue, green)};
+  __m128i redZero[] = {_mm_unpacklo_epi8(red, zero),
+                       _mm_unpackhi_epi8(red, zero)};
+  const __m128i low = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+  const __m128i high = _mm_set_epi32(0x0000FFFF, static_cast<int>(0xFF000000),
+                                     0x0000FFFF, static_cast<int>(0xFF000000));
+  for (int i = 0; i < 4; i++) {
+    __m128i pixels;
+    if (i & 1)
+      pixels = _mm_unpackhi_epi16(blueGreen[i >> 1], redZero[i >> 1]);
+    else
+      pixels = _mm_unpacklo_epi16(blueGreen[i >> 1], redZero[i >> 1]);
+    __m128i packed = _mm_or_si128(_mm_and_si128(pixels, low),
+      _mm_and_si128(_mm_srli_epi64(pixels, 8), high));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i * 12), packed);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i * 12 + 6),
+                     _mm_srli_si128(packed, 8));
+  }
+}
+
+DAGON_TARGET_SSE2
+static int ConvertSSE2(const unsigned char* y0, const unsigned char* y1,
+                       const unsigned char* u, const unsigned char* v,
+                       unsigned char* out0, unsigned char* out1, int width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi16(128);
+  int x = 0;
+
+  // At least two more pixels must follow to absorb the spilled bytes
+  for (; x + 16 < width; x += 16) {
+    __m128i cu = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(
+      reinterpret_cast<const __m128i*>(u + (x >> 1))), zero), half);
+    __m128i cv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64(
+      reinterpret_cast<const __m128i*>(v + (x >> 1))), zero), half);
+
+    __m128i b[2], g[2], r[2], gv[2];
+    MultiplySSE2(cu, kCoBU, b);
+    MultiplySSE2(cu, -kCoGU, g);
+    MultiplySSE2(cv, -kCoGV, gv);
+    g[0] = _mm_add_epi32(g[0], gv[0]);
+    g[1] = _mm_add_epi32(g[1], gv[1]);
+    MultiplySSE2(cv, kCoRV, r);
+
+    RowSSE2(y0 + x, b, g, r, out0 + x * 3);
+    RowSSE2(y1 + x, b, g, r, out1 + x * 3);
+  }
+
+  return x;
+}
+
+// Picks the bytes of each channel for the three registers holding sixteen
+// packed pixels
+static const signed char InterleaveMasks[3][3][16] = {
+  {{0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+   {-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+   {-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1}},
+  {{-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+   {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+   {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1}},
+  {{-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+   {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+   {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}}
+};
+
+DAGON_TARGET_AVX2
+static inline __m128i ChannelAVX2(const __m256i* luma, const __m256i* chroma) {
+  __m256i low = _mm256_srai_epi32(_mm256_add_epi32(luma[0], chroma[0]), 8);
+  __m256i high = _mm256_srai_epi32(_mm256_add_epi32(luma[1], chroma[1]), 8);
+  // Packing works within lanes, so the quarters are put back in order
+  __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high),
+                                            0xD8);
+  return _mm_packus_epi16(_mm256_castsi256_si128(packed),
+                          _mm256_extracti128_si256(packed, 1));
+}
+
+DAGON_TARGET_AVX2
+static inline void RowAVX2(const unsigned char* y, const __m256i* b,
+                           const __m256i* g, const __m256i* r,
+                           unsigned char* out) {
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y));
+  __m256i factor = _mm256_set1_epi32(kCoY);
+  __m256i offset = _mm256_set1_epi32(16);
+  __m256i bias = _mm256_set1_epi32(kLumaBias);
+  __m256i luma[2];
+  luma[0] = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(
+    _mm256_cvtepu8_epi32(bytes), offset), factor), bias);
+  luma[1] = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(
+    _mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)), offset), factor), bias);
+
+  __m128i channels[3];
+  channels[0] = ChannelAVX2(luma, b);
+  channels[1] = ChannelAVX2(luma, g);
+  channels[2] = ChannelAVX2(luma, r);
+
+  for (int i = 0; i < 3; i++) {
+    __m128i packed = _mm_setzero_si128();
+    for (int j = 0; j < 3; j++) {
+      __m128i mask = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(InterleaveMasks[i][j]));
+      packed = _mm_or_si128(packed, _mm_shuffle_epi8(channels[j], mask));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 16), packed);
+  }
+}
+
+// Chroma of eight pairs, repeated for each pixel
+DAGON_TARGET_AVX2
+static inline void ChromaAVX2(const unsigned char* plane, __m256i* chroma) {
+  __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(plane));
+  __m128i pairs = _mm_unpacklo_epi8(bytes, bytes);
+  __m256i half = _mm256_set1_epi32(128);
+  chroma[0] = _mm256_sub_epi32(_mm256_cvtepu8_epi32(pairs), half);
+  chroma[1] = _mm256_sub_epi32(_mm256_cvtepu8_epi32(
+    _mm_srli_si128(pairs, 8)), half);
+}
+
+DAGON_TARGET_AVX2
+static int ConvertAVX2(const unsigned char* y0, const unsigned char* y1,
+                       const unsigned char* u, const unsigned char* v,
+                       unsigned char* out0, unsigned char* out1, int width) {
+  __m256i coBU = _mm256_set1_epi32(kCoBU);
+  __m256i coGU = _mm256_set1_epi32(-kCoGU);
+  __m256i coGV = _mm256_set1_epi32(-kCoGV);
+  __m256i coRV = _mm256_set1_epi32(kCoRV);
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    __m256i cu[2], cv[2];
+    ChromaAVX2(u + (x >> 1), cu);
+    ChromaAVX2(v + (x >> 1), cv);
+
+    __m256i b[2], g[2], r[2];
+    for (int i = 0; i < 2; i++) {
+      b[i] = _mm256_mullo_epi32(cu[i], coBU);
+      g[i] = _mm256_add_epi32(_mm256_mullo_epi32(cu[i], coGU),
+                              _mm256_mullo_epi32(cv[i], coGV));
+      r[i] = _mm256_mullo_epi32(cv[i], coRV);
+    }
+
+    RowAVX2(y0 + x, b, g, r, out0 + x * 3);
+    RowAVX2(y1 + x, b, g, r, out1 + x * 3);
+  }
+
+  return x;
+}
+
+#endif // DAGON_VIDEO_X86
+
+#ifdef DAGON_VIDEO_NEON
+
+// Eight pixels of a channel, from their luma and the chroma of four pairs
+static inline uint8x8_t ChannelNEON(const int32x4_t* luma, int32x4_t chroma) {
+  int32x4x2_t pairs = vzipq_s32(chroma, chroma);
+  int16x4_t low = vqshrn_n_s32(vaddq_s32(luma[0], pairs.val[0]), 8);
+  int16x4_t high = vqshrn_n_s32(vaddq_s32(luma[1], pairs.val[1]), 8);
+  return vqmovun_s16(vcombine_s16(low, high));
+}
+
+static inline void RowNEON(const unsigned char* y, const int32x4_t* b,
+                           const int32x4_t* g, const int32x4_t* r,
+                           unsigned char* out) {
+  uint8x16_t bytes = vld1q_u8(y);
+  int32x4_t bias = vdupq_n_s32(kLumaBias);
+  int16x8_t halves[2];
+  halves[0] = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(bytes),
+                                             vdup_n_u8(16)));
+  halves[1] = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(bytes),
+                                             vdup_n_u8(16)));
+
+  uint8x16x3_t pixels;
+  uint8x8_t channels[3][2];
+  for (int i = 0; i < 2; i++) {
+    int32x4_t luma[2];
+    luma[0] = vaddq_s32(vmull_n_s16(vget_low_s16(halves[i]), kCoY), bias);
+    luma[1] = vaddq_s32(vmull_n_s16(vget_high_s16(halves[i]), kCoY), bias);
+    channels[0][i] = ChannelNEON(luma, b[i]);
+    channels[1][i] = ChannelNEON(luma, g[i]);
+    channels[2][i] = ChannelNEON(luma, r[i]);
+  }
+  for (int i = 0; i < 3; i++)
+    pixels.val[i] = vcombine_u8(channels[i][0], channels[i][1]);
+  vst3q_u8(out, pixels);
+}
+
+static int ConvertNEON(const unsigned char* y0, const unsigned char* y1,
+                       const unsigned char* u, const unsigned char* v,
+                       unsigned char* out0, unsigned char* out1, int width) {
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    int16x8_t cu = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(u + (x >> 1)),
+                                                  vdup_n_u8(128)));
+    int16x8_t cv = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(v + (x >> 1)),
+                                                  vdup_n_u8(128)));
+
+    int32x4_t b[2], g[2], r[2];
+    b[0] = vmull_n_s16(vget_low_s16(cu), kCoBU);
+    b[1] = vmull_n_s16(vget_high_s16(cu), kCoBU);
+    g[0] = vmlal_n_s16(vmull_n_s16(vget_low_s16(cu), -kCoGU),
+                       vget_low_s16(cv), -kCoGV);
+    g[1] = vmlal_n_s16(vmull_n_s16(vget_high_s16(cu), -kCoGU),
+                       vget_high_s16(cv), -kCoGV);
+    r[0] = vmull_n_s16(vget_low_s16(cv), kCoRV);
+    r[1] = vmull_n_s16(vget_high_s16(cv), kCoRV);
+
+    RowNEON(y0 + x, b, g, r, out0 + x * 3);
+    RowNEON(y1 + x, b, g, r, out1 + x * 3);
+  }
+
+  return x;
+}
+
+#endif // DAGON_VIDEO_NEON
+
+static int DetectKernel() {
+  const int arrayOfPreferred[] = {
+    kVideoKernelAVX2, kVideoKernelNEON, kVideoKernelSSE2
+  };
+  for (int i = 0; i < 3; i++) {
+    if (VideoConverter::isSupported(arrayOfPreferred[i]))
+      return arrayOfPreferred[i];
+  }
+  return kVideoKernelScalar;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Checks
+////////////////////////////////////////////////////////////
+
+bool VideoConverter::isSupported(int kernel) {
+  switch (kernel) {
+    case kVideoKernelScalar:
+      return true;
+#ifdef DAGON_VIDEO_X86
+    case kVideoKernelSSE2:
+      return SDL_HasSSE2() == SDL_TRUE;
+    case kVideoKernelAVX2:
+      return SDL_HasAVX2() == SDL_TRUE;
+#endif
+#ifdef DAGON_VIDEO_NEON
+    case kVideoKernelNEON:
+      // Only built when the compiler already assumes it
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - Gets
+////////////////////////////////////////////////////////////
+
+int VideoConverter::bestKernel() {
+  static const int kernel = DetectKernel();
+  return kernel;
+}
+
+const char* VideoConverter::kernelName(int kernel) {
+  if (kernel >= 0 && kernel < kVideoNumKernels)
+    return KernelNames[kernel];
+  else
+    return "";
+}
+
+////////////////////////////////////////////////////////////
+// Implementation - State changes
+////////////////////////////////////////////////////////////
+
+double VideoConverter::benchmark(int kernel, int width, int height,
+                                 int frames) {
+  if (!isSupported(kernel) || frames < 1)
+    return 0.0;
+
+  int chromaWidth = width / 2;
+  int chromaHeight = height / 2;
+  std::vector<unsigned char> luma(width * height);
+  std::vector<unsigned char> u(chromaWidth * chromaHeight);
+  std::vector<unsigned char> v(chromaWidth * chromaHeight);
+  std::vector<unsigned char> output(width * height * 3);
+
+  // Noise, so that no kernel benefits from predictable data
+  unsigned int seed = 1;
+  for (size_t i = 0; i < luma.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    luma[i] = static_cast<unsigned char>(seed >> 16);
+  }
+  for (size_t i = 0; i < u.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    u[i] = static_cast<unsigned char>(seed >> 16);
+    v[i] = static_cast<unsigned char>(seed >> 24);
+  }
+
+  Uint64 startTime = SDL_GetPerformanceCounter();
+  for (int i = 0; i < frames; i++) {
+    convert(kernel, &luma[0], width, &u[0], &v[0], chromaWidth, &output[0],
+            width, height);
+  }
+  Uint64 elapsed = SDL_GetPerformanceCounter() - startTime;
+
+  return (elapsed * 1000.0) / (SDL_GetPerformanceFrequency() *
+                               static_cast<double>(frames));
+}
+
+void VideoConverter::convert(const unsigned char* y, int yStride,
+                             const unsigned char* u, const unsigned char* v,
+                             int uvStride, unsigned char* output,
+                             int width, int height) {
+  convert(bestKernel(), y, yStride, u, v, uvStride, output, width, height);
+}
+
+void VideoConverter::convert(int kernel, const unsigned char* y, int yStride,
+                             const unsigned char* u, const unsigned char* v,
+                             int uvStride, unsigned char* output,
+                             int width, int height) {
+  SpanKernel span = NULL;
+  if (isSupported(kernel)) {
+    switch (kernel) {
+#ifdef DAGON_VIDEO_X86
+      case kVideoKernelSSE2:
+        span = ConvertSSE2;
+        break;
+      case kVideoKernelAVX2:
+        span = ConvertAVX2;
+        break;
+#endif
+#ifdef DAGON_VIDEO_NEON
+      case kVideoKernelNEON:
+        span = ConvertNEON;
+        break;
+#endif
+      default:
+        break;
+    }
+  }
+
+  int outStride = width * 3;
+  for (int row = 0; row < height; row += 2) {
+    const unsigned char* y0 = y + row * yStride;
+    const unsigned char* y1 = y0 + yStride;
+    const unsigned char* rowU = u + (row >> 1) * uvStride;
+    const unsigned char* rowV = v + (row >> 1) * uvStride;
+    unsigned char* out0 = output + row * outStride;
+    unsigned char* out1 = out0 + outStride;
+
+    int x = 0;
+    if (span)
+      x = span(y0, y1, rowU, rowV, out0, out1, width);
+    ConvertScalar(y0, y1, rowU, rowV, out0, out1, x, width);
+  }
+}
+
+}
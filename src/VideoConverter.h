@@ -0,0 +1,66 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+#ifndef DAGON_VIDEOCONVERTER_H_
+#define DAGON_VIDEOCONVERTER_H_
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+enum VideoKernels {
+  kVideoKernelScalar,
+  kVideoKernelSSE2,
+  kVideoKernelAVX2,
+  kVideoKernelNEON,
+  kVideoNumKernels
+};
+
+////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////
+
+// Converts 4:2:0 frames, as decoded by Theora, to packed BGR, which is how
+// textures take them. The kernel is picked once from the features of the
+// CPU, and every kernel produces the same output as the scalar one, bit for
+// bit. Safe to call from any thread.
+
+class VideoConverter {
+ public:
+  // Checks
+  // Built for this architecture and supported by the CPU
+  static bool isSupported(int kernel);
+
+  // Gets
+  static int bestKernel();
+  static const char* kernelName(int kernel);
+
+  // State changes
+  // Milliseconds per frame of a kernel, averaged over random frames
+  static double benchmark(int kernel, int width, int height, int frames);
+  // Width and height must be even. The output takes width * 3 bytes per row.
+  static void convert(const unsigned char* y, int yStride,
+                      const unsigned char* u, const unsigned char* v,
+                      int uvStride, unsigned char* output,
+                      int width, int height);
+  static void convert(int kernel, const unsigned char* y, int yStride,
+                      const unsigned char* u, const unsigned char* v,
+                      int uvStride, unsigned char* output,
+                      int width, int height);
+};
+
+}
+
+#endif // DAGON_VIDEOCONVERTER_H_
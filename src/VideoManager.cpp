@@ -15,10 +15,10 @@
 // Headers
 ////////////////////////////////////////////////////////////
 
-#include <SDL2/SDL_timer.h>
-
 #include "Config.h"
+#include "EffectsManager.h"
 #include "Log.h"
+#include "VideoConverter.h"
 #include "VideoManager.h"
 
 namespace dagon {
@@ -32,7 +32,6 @@ config(Config::instance()),
 log(Log::instance())
 {
   _isInitialized = false;
-  _isRunning = false;
   _mutex = SDL_CreateMutex();
   if (!_mutex)
     log.error(kModVideo, "%s", kString18001);
@@ -79,17 +78,18 @@ void VideoManager::flush() {
 
 void VideoManager::init() {
   log.trace(kModVideo, "%s", kString17001);
-  log.info(kModVideo, "%s: %s", kString17006, theora_version_string());
+  log.info(kModVideo, "%s: %s", kString17006, th_version_string());
+  // Frames are only converted on the CPU when shaders aren't available
+  if (EffectsManager::instance().hasVideoProgram())
+    log.info(kModVideo, "%s: shader", kString17011);
+  else
+    log.info(kModVideo, "%s: %s", kString17011,
+             VideoConverter::kernelName(VideoConverter::bestKernel()));
   
   // Eventually lots of Theora initialization process will be moved here
+  // Videos are decoded by their own workers, see Video
   
   _isInitialized = true;
-  _isRunning = true;
-  
-  _thread = SDL_CreateThread(_runThread, "VideoManager", (void*)NULL);
-  if (!_thread) {
-    log.error(kModVideo, "%s:%s", kString18003, SDL_GetError());
-  }
 }
 
 void VideoManager::registerVideo(Video* target) {
@@ -97,7 +97,8 @@ void VideoManager::registerVideo(Video* target) {
 }
 
 void VideoManager::requestVideo(Video* target) {
-  if (!target->isLoaded()) {
+  // Refused videos would be parsed and logged again on every visit
+  if (!target->isLoaded() && !target->hasFailed()) {
     target->load();
   }
   
@@ -128,11 +129,6 @@ void VideoManager::requestVideo(Video* target) {
 }
 
 void VideoManager::terminate() {
-  _isRunning = false;
-  
-  int threadReturnValue;
-  SDL_WaitThread(_thread, &threadReturnValue);
-  
   // WARNING: This code assumes videos are never created
   // directly in the script
   if (!_arrayOfVideos.empty()) {
@@ -148,35 +144,5 @@ void VideoManager::terminate() {
     }
   }
 }
-
-bool VideoManager::update() {
-  if (_isRunning) {
-    if (!_arrayOfActiveVideos.empty()) {
-      if (SDL_LockMutex(_mutex) == 0) {
-        std::vector<Video*>::iterator it = _arrayOfActiveVideos.begin();
-        while (it != _arrayOfActiveVideos.end()) {
-          (*it)->update();
-          ++it;
-        }
-        SDL_UnlockMutex(_mutex);
-      } else {
-        log.error(kModVideo, "%s", kString18002);
-      }
-    }
-    return true;
-  }
-  return false;
-}
-
-////////////////////////////////////////////////////////////
-// Implementation - Private methods
-////////////////////////////////////////////////////////////
-
-int VideoManager::_runThread(void *ptr) {
-  while (VideoManager::instance().update()) {
-    SDL_Delay(1);
-  }
-  return 0;
-}
   
 }
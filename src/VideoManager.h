@@ -19,7 +19,6 @@
 ////////////////////////////////////////////////////////////
 
 #include <SDL2/SDL_mutex.h>
-#include <SDL2/SDL_thread.h>
 
 #include "Platform.h"
 #include "Video.h"
@@ -42,14 +41,10 @@ class VideoManager {
   Log& log;
   
   SDL_mutex* _mutex;
-  SDL_Thread* _thread;
   std::vector<Video*> _arrayOfVideos;
   std::vector<Video*> _arrayOfActiveVideos;
   
   bool _isInitialized;
-  bool _isRunning;
-  
-  static int _runThread(void *ptr);
   
   VideoManager();
   VideoManager(VideoManager const&);
@@ -67,7 +62,6 @@ public:
   void registerVideo(Video* target);
   void requestVideo(Video* target);
   void terminate();
-  bool update();
 };
   
 }
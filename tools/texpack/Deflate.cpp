@@ -0,0 +1,200 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#include "Deflate.h"
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+#define kWindowSize 32768
+#define kHashSize 65536
+#define kMinMatch 3
+#define kMaxMatch 258
+#define kMaxChain 64
+
+static const int LengthBase[] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+  67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const int LengthExtra[] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+  5, 5, 5, 5, 0
+};
+
+static const int DistanceBase[] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+  769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const int DistanceExtra[] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+  11, 11, 12, 12, 13, 13
+};
+
+class BitWriter {
+  std::vector<unsigned char>& _output;
+  uint32_t _buffer;
+  int _count;
+
+ public:
+  explicit BitWriter(std::vector<unsigned char>& output) :
+  _output(output), _buffer(0), _count(0) {}
+
+  // Extra bits and headers go least significant bit first
+  void write(uint32_t bits, int count) {
+    _buffer |= bits << _count;
+    _count += count;
+    while (_count >= 8) {
+      _output.push_back(static_cast<unsigned char>(_buffer & 0xFF));
+      _buffer >>= 8;
+      _count -= 8;
+    }
+  }
+
+  // Huffman codes go most significant bit first
+  void writeCode(uint32_t code, int count) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < count; i++)
+      reversed |= ((code >> i) & 1) << (count - 1 - i);
+    write(reversed, count);
+  }
+
+  void flush() {
+    if (_count > 0)
+      _output.push_back(static_cast<unsigned char>(_buffer & 0xFF));
+    _buffer = 0;
+    _count = 0;
+  }
+};
+
+static void WriteLiteral(BitWriter& writer, int symbol) {
+  if (symbol < 144)
+    writer.writeCode(0x30 + symbol, 8);
+  else if (symbol < 256)
+    writer.writeCode(0x190 + symbol - 144, 9);
+  else if (symbol < 280)
+    writer.writeCode(symbol - 256, 7);
+  else
+    writer.writeCode(0xC0 + symbol - 280, 8);
+}
+
+static void WriteMatch(BitWriter& writer, int length, int distance) {
+  int code = 28;
+  while (LengthBase[code] > length)
+    code--;
+  WriteLiteral(writer, 257 + code);
+  writer.write(length - LengthBase[code], LengthExtra[code]);
+
+  code = 29;
+  while (DistanceBase[code] > distance)
+    code--;
+  writer.writeCode(code, 5);
+  writer.write(distance - DistanceBase[code], DistanceExtra[code]);
+}
+
+static uint32_t Hash(const unsigned char* data) {
+  return ((data[0] << 8) ^ (data[1] << 4) ^ data[2]) & (kHashSize - 1);
+}
+
+////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////
+
+void Deflate(const unsigned char* data, size_t size,
+             std::vector<unsigned char>& output) {
+  output.push_back(0x78); // Deflate with a 32K window
+  output.push_back(0x01); // No preset dictionary, fastest
+
+  BitWriter writer(output);
+  writer.write(1, 1); // Final block
+  writer.write(1, 2); // Fixed Huffman codes
+
+  std::vector<int64_t> head(kHashSize, -1);
+  std::vector<int64_t> previous(kWindowSize, -1);
+
+  size_t position = 0;
+  while (position < size) {
+    int bestLength = 0;
+    int bestDistance = 0;
+
+    if (position + kMinMatch <= size) {
+      uint32_t hash = Hash(&data[position]);
+      int64_t candidate = head[hash];
+      size_t available = size - position;
+      size_t limit = available < kMaxMatch ? available : kMaxMatch;
+
+      for (int chain = 0; chain < kMaxChain && candidate >= 0; chain++) {
+        size_t distance = position - static_cast<size_t>(candidate);
+        if (distance > kWindowSize)
+          break;
+
+        size_t length = 0;
+        while (length < limit &&
+               data[candidate + length] == data[position + length])
+          length++;
+
+        if (static_cast<int>(length) > bestLength) {
+          bestLength = static_cast<int>(length);
+          bestDistance = static_cast<int>(distance);
+          if (length == limit)
+            break;
+        }
+        candidate = previous[candidate & (kWindowSize - 1)];
+      }
+    }
+
+    int advance = 1;
+    if (bestLength >= kMinMatch) {
+      WriteMatch(writer, bestLength, bestDistance);
+      advance = bestLength;
+    } else {
+      WriteLiteral(writer, data[position]);
+    }
+
+    // Index every position we skip over
+    for (int i = 0; i < advance; i++, position++) {
+      if (position + kMinMatch <= size) {
+        uint32_t hash = Hash(&data[position]);
+        previous[position & (kWindowSize - 1)] = head[hash];
+        head[hash] = static_cast<int64_t>(position);
+      }
+    }
+  }
+
+  WriteLiteral(writer, 256); // End of block
+  writer.flush();
+
+  // Adler-32 of the uncompressed data, big-endian
+  uint32_t a = 1, b = 0;
+  for (size_t i = 0; i < size; i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  uint32_t adler = (b << 16) | a;
+  output.push_back(static_cast<unsigned char>(adler >> 24));
+  output.push_back(static_cast<unsigned char>((adler >> 16) & 0xFF));
+  output.push_back(static_cast<unsigned char>((adler >> 8) & 0xFF));
+  output.push_back(static_cast<unsigned char>(adler & 0xFF));
+}
+
+}
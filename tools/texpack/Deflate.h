@@ -0,0 +1,39 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+#ifndef DAGON_DEFLATE_H_
+#define DAGON_DEFLATE_H_
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+
+#include <vector>
+
+namespace dagon {
+
+////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////
+
+// Minimal zlib stream encoder: LZ77 over hash chains and fixed Huffman codes.
+// Good enough for the packer, whose output is inflated by stb_image at
+// runtime, and keeps the tool free of external dependencies.
+void Deflate(const unsigned char* data, size_t size,
+             std::vector<unsigned char>& output);
+
+}
+
+#endif // DAGON_DEFLATE_H_
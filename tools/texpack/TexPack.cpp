@@ -0,0 +1,356 @@
+////////////////////////////////////////////////////////////
+//
+// DAGON - An Adventure Game Engine
+// Copyright (c) 2011-2014 Senscape s.r.l.
+// All rights reserved.
+//
+// This Source Code Form is subject to the terms of the
+// Mozilla Public License, v. 2.0. If a copy of the MPL was
+// not distributed with this file, You can obtain one at
+// http://mozilla.org/MPL/2.0/.
+//
+////////////////////////////////////////////////////////////
+
+// dagon-texpack converts the six faces of a node into a TEX bundle with
+// S3TC compressed mipmaps, so that the engine only has to copy them to the
+// GPU. Faces are found with the same names the engine generates when
+// bundles are disabled, i.e. name001.png to name006.png.
+//
+// Usage: dagon-texpack [-z] [-v] [-j threads] [-s size] name [output]
+//
+//   -z  Wrap every face in a zlib stream (compression level 2)
+//   -v  Read the bundle back and compare it with what was written
+//   -j  Number of threads, all the cores by default
+//   -s  Scale the faces down to a resolution tier, e.g. 1024. The output
+//       is then named name@1024.tex, which the engine picks up as a tier.
+
+////////////////////////////////////////////////////////////
+// Headers
+////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Deflate.h"
+#include "TextureBundle.h"
+#include "TextureCompressor.h"
+#include "stb_image.h"
+
+using namespace dagon;
+
+////////////////////////////////////////////////////////////
+// Definitions
+////////////////////////////////////////////////////////////
+
+#define kNumFaces 6
+#define kRowsPerJob 32 // Rows of blocks encoded by each job
+
+// Same as kFileSeqStart and kFileSeqDigits in the engine
+#define kFirstFace 1
+static const char* Extensions[] = { "png", "jpg", "jpeg", "tga", "bmp" };
+
+struct Face {
+  std::string fileName;
+  std::vector<std::vector<unsigned char> > levels; // RGBA
+  std::vector<unsigned char> payload;
+  std::vector<unsigned char> deflated;
+};
+
+static void Run(int numOfThreads, int numOfJobs,
+                const std::function<void(int)>& job) {
+  std::atomic<int> next(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numOfThreads; i++) {
+    threads.push_back(std::thread([&]() {
+      int index;
+      while ((index = next++) < numOfJobs)
+        job(index);
+    }));
+  }
+
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+static bool FindFace(const std::string& name, int index,
+                     std::string& fileName) {
+  for (size_t i = 0; i < sizeof(Extensions) / sizeof(char*); i++) {
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "%s%03d.%s", name.c_str(),
+             kFirstFace + index, Extensions[i]);
+
+    FILE* fh = fopen(buffer, "rb");
+    if (fh) {
+      fclose(fh);
+      fileName = buffer;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void Usage() {
+  fprintf(stderr, "Usage: dagon-texpack [-z] [-v] [-j threads] [-s size] "
+          "name [output]\n");
+}
+
+static bool Verify(const std::string& fileName, int compressionLevel,
+                   std::vector<Face>& faces) {
+  TextureBundle bundle;
+  if (!bundle.open(fileName) || bundle.numTextures() != kNumFaces ||
+      bundle.compressionLevel() != compressionLevel)
+    return false;
+
+  for (int i = 0; i < kNumFaces; i++) {
+    const TextureBundleEntry& entry = bundle.entry(i);
+    std::vector<unsigned char> data(static_cast<size_t>(entry.size));
+    if (!bundle.read(i, &data[0]))
+      return false;
+
+    if (compressionLevel == 2) {
+      std::vector<char> inflated(static_cast<size_t>(entry.rawSize));
+      int size = stbi_zlib_decode_buffer(&inflated[0],
+                                         static_cast<int>(inflated.size()),
+                                         reinterpret_cast<char*>(&data[0]),
+                                         static_cast<int>(data.size()));
+      if (size != static_cast<int>(inflated.size()))
+        return false;
+      data.assign(inflated.begin(), inflated.end());
+    }
+
+    if (data != faces[i].payload)
+      return false;
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]) {
+  bool deflate = false;
+  bool verify = false;
+  int numOfThreads = std::thread::hardware_concurrency();
+  int tierSize = 0;
+  std::string name, output;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-z") == 0) {
+      deflate = true;
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verify = true;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      numOfThreads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      tierSize = atoi(argv[++i]);
+    } else if (argv[i][0] == '-') {
+      Usage();
+      return 1;
+    } else if (name.empty()) {
+      name = argv[i];
+    } else if (output.empty()) {
+      output = argv[i];
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+
+  if (name.empty()) {
+    Usage();
+    return 1;
+  }
+  if (output.empty() && tierSize > 0)
+    output = name + "@" + std::to_string(tierSize) + ".tex";
+  else if (output.empty())
+    output = name + ".tex";
+  if (numOfThreads < 1)
+    numOfThreads = 1;
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  // Load the faces, which must all have the same size
+  std::vector<Face> faces(kNumFaces);
+  int width = 0, height = 0;
+  bool hasAlpha = false;
+  size_t inputSize = 0;
+  for (int i = 0; i < kNumFaces; i++) {
+    if (!FindFace(name, i, faces[i].fileName)) {
+      fprintf(stderr, "Face %d of %s not found\n", kFirstFace + i,
+              name.c_str());
+      return 1;
+    }
+  }
+
+  std::atomic<bool> failed(false);
+  std::vector<int> sizes(kNumFaces * 3);
+  Run(numOfThreads, kNumFaces, [&](int i) {
+    int x, y, comp;
+    unsigned char* bitmap = stbi_load(faces[i].fileName.c_str(), &x, &y,
+                                      &comp, STBI_rgb_alpha);
+    if (!bitmap) {
+      fprintf(stderr, "Error while loading %s: %s\n",
+              faces[i].fileName.c_str(), stbi_failure_reason());
+      failed = true;
+      return;
+    }
+    faces[i].levels.push_back(std::vector<unsigned char>(bitmap,
+                                                         bitmap + x * y * 4));
+    stbi_image_free(bitmap);
+    sizes[i * 3] = x;
+    sizes[i * 3 + 1] = y;
+    sizes[i * 3 + 2] = comp;
+  });
+  if (failed)
+    return 1;
+
+  for (int i = 0; i < kNumFaces; i++) {
+    if (i == 0) {
+      width = sizes[0];
+      height = sizes[1];
+    } else if (sizes[i * 3] != width || sizes[i * 3 + 1] != height) {
+      fprintf(stderr, "%s doesn't match the size of the other faces\n",
+              faces[i].fileName.c_str());
+      return 1;
+    }
+    if (sizes[i * 3 + 2] == STBI_grey_alpha ||
+        sizes[i * 3 + 2] == STBI_rgb_alpha)
+      hasAlpha = true;
+  }
+
+  int format = hasAlpha ? kTexFormatBC3 : kTexFormatBC1;
+  int numOfLevels = TextureCompressor::numLevels(width, height);
+
+  // Build the mipmap chains, one face per thread
+  Run(numOfThreads, kNumFaces, [&](int i) {
+    int w = width, h = height;
+    for (int level = 1; level < numOfLevels; level++) {
+      int outWidth = w > 1 ? w / 2 : 1;
+      int outHeight = h > 1 ? h / 2 : 1;
+      faces[i].levels.push_back(
+        std::vector<unsigned char>(outWidth * outHeight * 4));
+      TextureCompressor::downsample(&faces[i].levels[level - 1][0], w, h,
+                                    &faces[i].levels[level][0]);
+      w = outWidth;
+      h = outHeight;
+    }
+  });
+
+  // A tier simply starts further down the chain
+  if (tierSize > 0) {
+    int level = 0;
+    while (level < numOfLevels - 1 && (width >> level) > tierSize)
+      level++;
+    if ((width >> level) != tierSize) {
+      fprintf(stderr, "%d is not a power of two fraction of %dx%d\n",
+              tierSize, width, height);
+      return 1;
+    }
+
+    for (int i = 0; i < kNumFaces; i++)
+      faces[i].levels.erase(faces[i].levels.begin(),
+                            faces[i].levels.begin() + level);
+    width >>= level;
+    height = (height >> level) > 1 ? height >> level : 1;
+    numOfLevels -= level;
+  }
+
+  for (int i = 0; i < kNumFaces; i++)
+    faces[i].payload.resize(TextureCompressor::chainSize(format, width, height,
+                                                         numOfLevels));
+
+  // Split every level in bands of block rows so all the cores stay busy
+  struct Job {
+    int face, level, width, height, fromRow, toRow;
+    size_t offset;
+  };
+  std::vector<Job> jobs;
+  for (int i = 0; i < kNumFaces; i++) {
+    int w = width, h = height;
+    size_t offset = 0;
+    for (int level = 0; level < numOfLevels; level++) {
+      int rows = (h + 3) / 4;
+      for (int row = 0; row < rows; row += kRowsPerJob) {
+        Job job = { i, level, w, h, row,
+                    row + kRowsPerJob < rows ? row + kRowsPerJob : rows,
+                    offset };
+        jobs.push_back(job);
+      }
+      offset += TextureCompressor::levelSize(format, w, h);
+      w = w > 1 ? w / 2 : 1;
+      h = h > 1 ? h / 2 : 1;
+    }
+  }
+
+  Run(numOfThreads, static_cast<int>(jobs.size()), [&](int index) {
+    const Job& job = jobs[index];
+    Face& face = faces[job.face];
+    TextureCompressor::compress(format, &face.levels[job.level][0],
+                                job.width, job.height,
+                                &face.payload[job.offset],
+                                job.fromRow, job.toRow);
+  });
+
+  if (deflate) {
+    Run(numOfThreads, kNumFaces, [&](int i) {
+      Deflate(&faces[i].payload[0], faces[i].payload.size(),
+              faces[i].deflated);
+    });
+  }
+
+  // Write the bundle
+  std::vector<TextureBundleEntry> arrayOfEntries;
+  std::vector<const void*> arrayOfPayloads;
+  size_t outputSize = 0;
+  for (int i = 0; i < kNumFaces; i++) {
+    std::vector<unsigned char>& data = deflate ? faces[i].deflated :
+                                                 faces[i].payload;
+    TextureBundleEntry entry;
+    entry.cubePosition = i;
+    entry.depth = hasAlpha ? 32 : 24;
+    entry.format = format;
+    entry.levels = numOfLevels;
+    entry.offset = 0; // Filled by the writer
+    entry.size = data.size();
+    entry.rawSize = faces[i].payload.size();
+    arrayOfEntries.push_back(entry);
+    arrayOfPayloads.push_back(&data[0]);
+    outputSize += data.size();
+    inputSize += faces[i].levels[0].size();
+  }
+
+  int compressionLevel = deflate ? 2 : 1;
+  if (!TextureBundle::write(output, width, height, compressionLevel,
+                            arrayOfEntries, arrayOfPayloads)) {
+    fprintf(stderr, "Could not write %s\n", output.c_str());
+    return 1;
+  }
+
+  double seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  printf("%s: %dx%d %s, %d levels, %.1f MB to %.1f MB in %.2f s "
+         "(%d threads)\n", output.c_str(), width, height,
+         hasAlpha ? "BC3" : "BC1", numOfLevels, inputSize / 1048576.0,
+         outputSize / 1048576.0, seconds, numOfThreads);
+
+  if (verify) {
+    if (!Verify(output, compressionLevel, faces)) {
+      fprintf(stderr, "%s: verification failed\n", output.c_str());
+      return 1;
+    }
+    printf("%s: verified\n", output.c_str());
+  }
+
+  return 0;
+}